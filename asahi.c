@@ -194,11 +194,13 @@ asahi_ifd(u_int32_t offset, struct tiffmeta *md)
 		 */
 
 		if (!memcmp("MM", md->btiff + offset + 4, 2)) {
-			exifwarn("Asahi maker note version not supported");
+			exifnote("Asahi maker note version not supported",
+			    NULL, md->t);
 			return (NULL);
 		}
 
-		exifwarn("Asahi maker note version not supported");
+		exifnote("Asahi maker note version not supported", NULL,
+		    md->t);
 		return (NULL);
 	}
 
@@ -208,7 +210,8 @@ asahi_ifd(u_int32_t offset, struct tiffmeta *md)
 	 */
 
 	if (exif2byte(md->btiff + offset, md->order) < 10) {
-		exifwarn("Asahi maker note version not supported");
+		exifnote("Asahi maker note version not supported", NULL,
+		    md->t);
 		return (NULL);
 	}
 
@@ -943,14 +943,14 @@ canon_prop01(struct exifprop *aprop, struct exifprop *prop,
 	switch (aprop->tag) {
 	case 2:
 		aprop->lvl = v ? ED_IMG : ED_VRB;
-		exifstralloc(&aprop->str, 32);
+		exifstralloc(&aprop->str, 32, t);
 		snprintf(aprop->str, 31, "%d sec", v / 10);
 		break;
 	case 5:
 		/* Change "Single" to "Timed" if #2 > 0. */
 
 		if (!v && exif2byte(off + 2 * 2, t->mkrmd.order))
-			strcpy(aprop->str, "Timed");
+			aprop->str = "Timed";
 		break;
 	case 12:
 		aprop->lvl = v ? ED_IMG : ED_VRB;
@@ -961,12 +961,12 @@ canon_prop01(struct exifprop *aprop, struct exifprop *prop,
 		 */
 
 		if (v == 3 && prop->count >= 37) {
-			exifstralloc(&aprop->str, 32);
+			exifstralloc(&aprop->str, 32, t);
 			snprintf(aprop->str, 31, "x%.1f", 2 *
 			    (float)exif2byte(off + 37 * 2, t->mkrmd.order) /
 			    (float)exif2byte(off + 36 * 2, t->mkrmd.order));
 		} else
-			aprop->str = finddescr(canon_dzoom, v);
+			descrprop(aprop, canon_dzoom, v, t);
 		break;
 	case 16:
 		/* ISO overrides standard one if known. */
@@ -1010,7 +1010,7 @@ canon_prop04(struct exifprop *aprop, struct exifprop *prop,
 	switch (aprop->tag) {
 	case 6:
 		/* Calculate sensor speed (ISO units). */
-		exifstralloc(&aprop->str, 32);
+		exifstralloc(&aprop->str, 32, t);
 		snprintf(aprop->str, 31, "%d", (int)(exp(calcev(NULL, 0, v) *
 		    log(2)) * 100.0 / 32.0 + 0.5));
 		break;
@@ -1022,7 +1022,7 @@ canon_prop04(struct exifprop *aprop, struct exifprop *prop,
 		aprop->lvl = v ? ED_IMG : ED_VRB;
 		break;
 	case 15:
-		exifstralloc(&aprop->str, 16);
+		exifstralloc(&aprop->str, 16, t);
 		if (calcev(aprop->str, 15, v) == 0.0)
 			aprop->lvl = ED_VRB;
 		break;
@@ -1038,7 +1038,7 @@ canon_prop04(struct exifprop *aprop, struct exifprop *prop,
 	 */
 
 	case 19:
-		exifstralloc(&aprop->str, 32);
+		exifstralloc(&aprop->str, 32, t);
 
 		if (!v) {
 			aprop->lvl = ED_VRB;
@@ -1061,8 +1061,8 @@ canon_prop04(struct exifprop *aprop, struct exifprop *prop,
 			snprintf(aprop->str, 31, "%.3f m",
 			    (float)v / (float)d);
 
-		if ((tmpprop = findprop(t->props, tags, EXIF_T_DISTANCE))) {
-			if (strcmp(tmpprop->str, "Unknown"))
+		if ((tmpprop = findprop(t, tags, EXIF_T_DISTANCE))) {
+			if (strcmp(propstr(tmpprop, t), "Unknown"))
 				aprop->lvl = ED_VRB;
 			else
 				aprop->override = EXIF_T_DISTANCE;
@@ -1087,7 +1087,7 @@ canon_propA0(struct exifprop *aprop, struct exifprop *prop,
 
 	switch (aprop->tag) {
 	case 9:
-		exifstralloc(&aprop->str, 32);
+		exifstralloc(&aprop->str, 32, t);
 		snprintf(aprop->str, 31, "%d K", aprop->value);
 		break;
 	default:
@@ -1106,53 +1106,53 @@ static int
 canon_subval(struct exifprop *prop, struct exiftags *t,
     struct exiftag *subtags, int (*valfun)())
 {
-	int i, j;
+	int i;
 	u_int16_t v;
 	struct exifprop *aprop;
+	struct exiftag *def;
 	unsigned char *off = t->mkrmd.btiff + prop->value;
 
 	/* Check size of tag (first value) if we're not debugging. */
 
 	if (valfun && exif2byte(off, t->mkrmd.order) != 2 * prop->count) {
-		exifwarn("Canon maker tag appears corrupt");
+		exifnote("Canon maker tag appears corrupt", NULL, t);
 		return (FALSE);
 	}
 
-	if (debug)
+	if (t->debug)
 		printf("Processing %s (0x%04X) directory, %d entries\n",
 		    prop->name, prop->tag, prop->count);
 
 	for (i = 0; i < (int)prop->count; i++) {
 		v = exif2byte(off + i * 2, t->mkrmd.order);
 
-		aprop = childprop(prop);
+		aprop = childprop(prop, t);
 		aprop->value = (u_int32_t)v;
 		aprop->tag = i;
 		aprop->tagset = subtags;
 
 		/* Lookup property name and description. */
 
-		for (j = 0; subtags[j].tag < EXIF_T_UNKNOWN &&
-		    subtags[j].tag != i; j++);
-		aprop->name = subtags[j].name;
-		aprop->descr = subtags[j].descr;
-		aprop->lvl = subtags[j].lvl;
-		if (subtags[j].table)
-			aprop->str = finddescr(subtags[j].table, v);
+		def = aprop->def = findtag(subtags, (u_int16_t)i, t);
+		aprop->name = def->name;
+		aprop->descr = def->descr;
+		aprop->lvl = def->lvl;
+		if (def->table)
+			descrprop(aprop, def->table, v, t);
 
-		dumpprop(aprop, NULL);
+		dumpprop(aprop, NULL, t);
 
 		/* Process individual values.  Returns false if unknown. */
 
 		if (valfun && !valfun(aprop, prop, off, t)) {
 			if (aprop->lvl != ED_UNK)
 				continue;
-			exifstralloc(&aprop->str, 32);
+			exifstralloc(&aprop->str, 32, t);
 			snprintf(aprop->str, 31, "num %02d, val 0x%04X", i, v);
 		}
 	}
 
-	if (debug)
+	if (t->debug)
 		printf("\n");
 	return (TRUE);
 }
@@ -1163,13 +1163,14 @@ canon_subval(struct exifprop *prop, struct exiftags *t,
  */
 static void
 canon_custom(struct exifprop *prop, unsigned char *off, enum byteorder o,
-    struct exiftag *table)
+    struct exiftag *table, struct exiftags *t)
 {
-	int i, j = -1;
+	int i;
 	const char *cn;
-	char *cv = NULL;
+	const char *cv = NULL;
 	u_int16_t v;
 	struct exifprop *aprop;
+	struct exiftag *def;
 
 	/*
 	 * Check size of tag (first value).
@@ -1180,18 +1181,18 @@ canon_custom(struct exifprop *prop, unsigned char *off, enum byteorder o,
 
 	if (exif2byte(off, o) != 2 * prop->count &&
 	    exif2byte(off, o) != 2 * (prop->count - 1)) {
-		exifwarn("Canon custom tag appears corrupt");
+		exifnote("Canon custom tag appears corrupt", NULL, t);
 		return;
 	}
 
-	if (debug)
+	if (t->debug)
 		printf("Processing %s directory, %d entries\n", prop->name,
 		    prop->count);
 
 	for (i = 1; i < (int)prop->count; i++) {
 		v = exif2byte(off + i * 2, o);
 
-		aprop = childprop(prop);
+		aprop = childprop(prop, t);
 		aprop->value = v & 0xff;
 		aprop->tag = v >> 8 & 0xff;
 		aprop->tagset = table;
@@ -1201,26 +1202,24 @@ canon_custom(struct exifprop *prop, unsigned char *off, enum byteorder o,
 		 * number; second is function value.
 		 */
 
-		for (j = 0; table[j].tag != EXIF_T_UNKNOWN &&
-		    table[j].tag != (v >> 8 & 0xff); j++);
-		aprop->name = table[j].name;
+		def = aprop->def = findtag(table, (u_int16_t)(v >> 8 & 0xff),
+		    t);
+		aprop->name = def->name;
 		aprop->descr = prop->descr;
-		aprop->lvl = table[j].lvl;
-		if (table[j].table)
-			cv = finddescr(table[j].table,
-			    (u_int16_t)(v & 0xff));
-		cn = table[j].descr;
+		aprop->lvl = def->lvl;
+		if (def->table)
+			cv = finddescr(def->table, (u_int16_t)(v & 0xff), t);
+		cn = def->descr;
 
 
-		dumpprop(aprop, NULL);
+		dumpprop(aprop, NULL, t);
 
 		exifstralloc(&aprop->str, 4 + strlen(cn) +
-		    (cv ? strlen(cv) : 10));
+		    (cv ? strlen(cv) : 10), t);
 
-		if (cv && j != -1) {
+		if (cv) {
 			snprintf(aprop->str, 4 + strlen(cn) + strlen(cv),
 			    "%s - %s", cn, cv);
-			free(cv);
 			cv = NULL;
 		} else {
 			snprintf(aprop->str, 4 + strlen(cn) + 10, "%s %d - %d",
@@ -1230,7 +1229,7 @@ canon_custom(struct exifprop *prop, unsigned char *off, enum byteorder o,
 		}
 	}
 
-	if (debug)
+	if (t->debug)
 		printf("\n");
 }
 
@@ -1268,10 +1267,10 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 		}
 
 		if (flunit && (flmin || flmax)) {
-			tmpprop = childprop(prop);
+			tmpprop = childprop(prop, t);
 			tmpprop->name = "CanonLensSz";
 			tmpprop->descr = "Lens Size";
-			exifstralloc(&tmpprop->str, 32);
+			exifstralloc(&tmpprop->str, 32, t);
 
 			if (flmin == flmax) {
 				snprintf(tmpprop->str, 31, "%.2f mm",
@@ -1296,9 +1295,10 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 
 		/* Color temp is bad if white balance isn't manual. */
 
-		if ((tmpprop = findprop(t->props, canon_tags04, 7)))
+		if ((tmpprop = findprop(t, canon_tags04, 7)))
 			if (tmpprop->value != 9) {
-				if ((tmpprop = findprop(prop, canon_tagsA0, 9)))
+				if ((tmpprop = findnextprop(prop,
+				    canon_tagsA0, 9)))
 					tmpprop->lvl = ED_BAD;
 		}
 		break;
@@ -1315,7 +1315,8 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 		 */
 
 		if (!t->model) {
-			exifwarn("Canon model unset; please report to author");
+			exifnote("Canon model unset; please report to author",
+			    NULL, t);
 			break;
 		}
 
@@ -1327,11 +1328,12 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 
 			/* Image number is in two shorts... */
 
-			if ((tmpprop = findprop(t->props, canon_tags93, 1))) {
+			if ((tmpprop = findprop(t, canon_tags93, 1))) {
 				v = tmpprop->value >> 6;
 				w = (tmpprop->value & 0x3f) << 8;
 
-				if ((tmpprop = findprop(prop, canon_tags93, 2)))
+				if ((tmpprop = findnextprop(prop,
+				    canon_tags93, 2)))
 					w += tmpprop->value;
 				else {
 					v = 0;
@@ -1340,11 +1342,11 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 			}
 
 			if (v) {
-				tmpprop = childprop(prop);
+				tmpprop = childprop(prop, t);
 				tmpprop->name = "ImgNum";
 				tmpprop->descr = "Image Number";
 				tmpprop->lvl = ED_IMG;
-				exifstralloc(&tmpprop->str, 32);
+				exifstralloc(&tmpprop->str, 32, t);
 				snprintf(tmpprop->str, 31, "%03d-%04d", v, w);
 			}
 			break;
@@ -1352,17 +1354,17 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 
 		/* Number of acuations is in two shorts... */
 
-		if ((tmpprop = findprop(t->props, canon_tags93, 1))) {
+		if ((tmpprop = findprop(t, canon_tags93, 1))) {
 			v = tmpprop->value * 65536;
 
-			if ((tmpprop = findprop(prop, canon_tags93, 2)))
+			if ((tmpprop = findnextprop(prop, canon_tags93, 2)))
 				v += tmpprop->value;
 			else
 				v = 0;
 		}
 
 		if (v) {
-			tmpprop = childprop(prop);
+			tmpprop = childprop(prop, t);
 			tmpprop->name = "CanonActuations";
 			tmpprop->descr = "Camera Actuations";
 			tmpprop->lvl = ED_IMG;
@@ -1375,7 +1377,7 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 	case 0x0008:
 		if (!prop->value)
 			prop->lvl = ED_VRB;
-		exifstralloc(&prop->str, 32);
+		exifstralloc(&prop->str, 32, t);
 		snprintf(prop->str, 31, "%03d-%04d", prop->value / 10000,
 		    prop->value % 10000);
 		break;
@@ -1383,7 +1385,7 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 	/* Serial number. */
 
 	case 0x000c:
-		exifstralloc(&prop->str, 11);
+		exifstralloc(&prop->str, 11, t);
 		snprintf(prop->str, 11, "%010d", prop->value);
 		break;
 
@@ -1398,36 +1400,37 @@ canon_prop(struct exifprop *prop, struct exiftags *t)
 		 */
 
 		if (!t->model) {
-			exifwarn("Canon model unset; please report to author");
+			exifnote("Canon model unset; please report to author",
+			    NULL, t);
 			break;
 		}
 
 		if (strstr(t->model, "10D"))
 			canon_custom(prop, t->mkrmd.btiff + prop->value,
-			    t->mkrmd.order, canon_10dcustom);
+			    t->mkrmd.order, canon_10dcustom, t);
 		else if (strstr(t->model, "D30") || strstr(t->model, "D60"))
 			canon_custom(prop, t->mkrmd.btiff + prop->value,
-			    t->mkrmd.order, canon_d30custom);
+			    t->mkrmd.order, canon_d30custom, t);
 		else if (strstr(t->model, "20D"))
 			canon_custom(prop, t->mkrmd.btiff + prop->value,
-			    t->mkrmd.order, canon_20dcustom);
+			    t->mkrmd.order, canon_20dcustom, t);
 		else if (strstr(t->model, "5D"))
 			canon_custom(prop, t->mkrmd.btiff + prop->value,
-			    t->mkrmd.order, canon_5dcustom);
+			    t->mkrmd.order, canon_5dcustom, t);
 		else
-			exifwarn2("Custom function unsupported; please "
-			    "report to author", t->model);
+			exifnote("Custom function unsupported; please "
+			    "report to author", t->model, t);
 		break;
 
 	case 0x0090:
 		canon_custom(prop, t->mkrmd.btiff + prop->value, t->mkrmd.order,
-		    canon_1dcustom);
+		    canon_1dcustom, t);
 		break;
 
 	/* Dump debug for tags of type short w/count > 1. */
 
 	default:
-		if (prop->type == TIFF_SHORT && prop->count > 1 && debug)
+		if (prop->type == TIFF_SHORT && prop->count > 1 && t->debug)
 			canon_subval(prop, t, canon_tagsunk, NULL);
 		break;
 	}
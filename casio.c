@@ -204,7 +204,8 @@ casio_ifd(u_int32_t offset, struct tiffmeta *md)
 
 	if (!memcmp("QVC\0\0\0", md->btiff + offset, 6)) {
 		readifd(offset + strlen("QVC") + 3, &myifd, casio_tags1, md);
-		exifwarn("Casio maker note version not supported");
+		exifnote("Casio maker note version not supported", NULL,
+		    md->t);
 	} else
 		readifd(offset, &myifd, casio_tags0, md);
 
@@ -47,10 +47,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
 #include <math.h>
 #include <float.h>
 #include <ctype.h>
+#include <setjmp.h>
 
 #include "exif.h"
 #include "exifint.h"
@@ -66,20 +66,37 @@
 
 static void parsetag(struct exifprop *prop, struct ifd *dir,
     struct exiftags *t, int domkr);
+static void visitifd(struct exifprop *prev, struct exiftags *t, int domkr);
+static void sanestr(char *s);
 
 
 /*
  * Create an Exif property from the raw IFD field data.
  */
 static void
-readtag(struct field *afield, int ifdseq, struct ifd *dir, struct exiftags *t,
-    int domkr)
+readtag(struct fieldvals *fvs, int i, struct field *afield, int ifdseq,
+    struct ifd *dir, struct exiftags *t, int domkr)
 {
-	int i, j;
-	struct exifprop *prop, *tmpprop;
+	int strict;
+	u_int32_t size;
+	struct exifprop *prop;
+	struct exiftag *def;
 	u_int16_t tag;
 
-	prop = newprop();
+	/*
+	 * If the section's coming in pieces, pass over a field whose value
+	 * hasn't arrived yet.
+	 */
+
+	if (fvs->ftype[i] >= 0) {
+		size = (u_int32_t)ftypes[(int)fvs->ftype[i]].size;
+		if (size && fvs->counts[i] <= (u_int32_t)(-1) / size &&
+		    size * fvs->counts[i] > 4 && exifincmiss(t->ctx,
+		    dir->md.btiff, fvs->values[i], size * fvs->counts[i]))
+			return;
+	}
+
+	prop = newprop(t);
 	if (dir->par)
 		tag = dir->par->tag;
 	else
@@ -87,15 +104,10 @@ readtag(struct field *afield, int ifdseq, struct ifd *dir, struct exiftags *t,
 
 	/* Field info. */
 
-	prop->tag = exif2byte(afield->tag, dir->md.order);
-	prop->type = exif2byte(afield->type, dir->md.order);
-	prop->count = exif4byte(afield->count, dir->md.order);
-	/* XXX Makes dealing with two shorts somewhat messy. */
-	if ((prop->type == TIFF_SHORT || prop->type == TIFF_SSHORT) &&
-	    prop->count <= 1)
-		prop->value = exif2byte(afield->value, dir->md.order);
-	else
-		prop->value = exif4byte(afield->value, dir->md.order);
+	prop->tag = fvs->tags[i];
+	prop->type = fvs->types[i];
+	prop->count = fvs->counts[i];
+	prop->value = fvs->values[i];
 
 	/* IFD identifying info. */
 
@@ -103,31 +115,34 @@ readtag(struct field *afield, int ifdseq, struct ifd *dir, struct exiftags *t,
 	prop->par = dir->par;
 	prop->tagset = dir->tagset;
 
-	/* Lookup the field name. */
+	/* Lookup the field name; the definition stays with the property. */
 
-	for (i = 0; prop->tagset[i].tag < EXIF_T_UNKNOWN &&
-	    prop->tagset[i].tag != prop->tag; i++);
-	prop->name = prop->tagset[i].name;
-	prop->descr = prop->tagset[i].descr;
-	prop->lvl = prop->tagset[i].lvl;
+	def = prop->def = findtag(prop->tagset, prop->tag, t);
+	prop->name = def->name;
+	prop->descr = def->descr;
+	prop->lvl = def->lvl;
 
 	/*
-	 * Lookup and check the field type.
+	 * Check the field type (looked up by decfields()).
 	 *
 	 * We have to be pretty severe with entries that have an invalid
 	 * field type -- too many assumptions in the rest of the code.
 	 */
 
-	for (j = 0; ftypes[j].type && ftypes[j].type != prop->type; j++);
-	if (!ftypes[j].type) {
-		exifwarn2("unknown TIFF field type; discarding", prop->name);
-		free(prop);
+	if (fvs->ftype[i] < 0) {
+		exifnote("unknown TIFF field type; discarding", prop->name,
+		    t);
 		return;
 	}
 
-	/* Skip sanity checking on maker note tags; we'll get to them later. */
+	/*
+	 * Skip sanity checking on maker note tags, unless the maker module
+	 * trusts its definitions enough to ask for it.  Even then, we only
+	 * warn about them.
+	 */
 
-	if (tag != EXIF_T_MAKERNOTE) {
+	strict = (tag != EXIF_T_MAKERNOTE);
+	if (strict || makers[t->mkrval].chkdef) {
 		/*
 		 * XXX Ignore UserComment -- a hack to get around an apparent
 		 * WinXP Picture Viewer bug (err, liberty).  When you rotate
@@ -136,13 +151,13 @@ readtag(struct field *afield, int ifdseq, struct ifd *dir, struct exiftags *t,
 		 * (At least we're able to ID invalid comments...)
 		 */
 
-		if (prop->tagset[i].type && prop->tagset[i].type !=
-		    prop->type) {
+		if (def->type && def->type != prop->type) {
 #ifdef WINXP_BUGS
 			if (prop->tag != EXIF_T_USERCOMMENT)
 #endif
-				exifwarn2("field type mismatch", prop->name);
-			prop->lvl = ED_BAD;
+				exifnote("field type mismatch", prop->name, t);
+			if (strict)
+				prop->lvl = ED_BAD;
 		}
 
 		/*
@@ -151,23 +166,23 @@ readtag(struct field *afield, int ifdseq, struct ifd *dir, struct exiftags *t,
 		 * spec on count for FileSource.
 		 */
 
-		if (prop->tagset[i].count && prop->tagset[i].count !=
+		if (def->count && def->count !=
 #ifdef SIGMA_BUGS
 		    prop->count && prop->tag != EXIF_T_FILESRC) {
 #else
 		    prop->count) {
 #endif
-			exifwarn2("field count mismatch", prop->name);
+			exifnote("field count mismatch", prop->name, t);
 
 			/* Let's be forgiving with ASCII fields. */
-			if (prop->type != TIFF_ASCII)
+			if (strict && prop->type != TIFF_ASCII)
 				prop->lvl = ED_BAD;
 		}
 	}
 
 	/* Debuggage. */
 
-	dumpprop(prop, afield);
+	dumpprop(prop, afield, t);
 
 	/*
 	 * Do as much as we can with the tag at this point and add it
@@ -175,12 +190,151 @@ readtag(struct field *afield, int ifdseq, struct ifd *dir, struct exiftags *t,
 	 */
 
 	parsetag(prop, dir, t, domkr);
-	if ((tmpprop = t->props)) {
-		while (tmpprop->next)
-			tmpprop = tmpprop->next;
-		tmpprop->next = prop;
-	} else
+	if (t->lastprop)
+		t->lastprop->next = prop;
+	else
 		t->props = prop;
+	t->lastprop = prop;
+	propindex(prop, t, FALSE);
+}
+
+
+/*
+ * Decide whether a selective scan needs a field: either it's a wanted
+ * tag we haven't found yet, or it points to an IFD that might hold one.
+ */
+static int
+selfield(struct fieldvals *fvs, int n, struct ifd *dir, struct exiftags *t)
+{
+	int i;
+	u_int16_t tag;
+	struct exiftag *sub;
+	struct selscan *ss = (struct selscan *)t->sel;
+
+	tag = fvs->tags[n];
+
+	for (i = 0; ss->sel[i].tagset; i++)
+		if (!ss->found[i] && ss->sel[i].tagset == dir->tagset &&
+		    ss->sel[i].tag == tag)
+			return (TRUE);
+
+	/* Exif and Interop IFDs use the standard tags; GPS has its own. */
+
+	if (dir->tagset != tags)
+		sub = NULL;
+	else if (tag == EXIF_T_EXIFIFD || tag == EXIF_T_INTEROP)
+		sub = tags;
+	else if (tag == EXIF_T_GPSIFD)
+		sub = gpstags;
+	else
+		sub = NULL;
+
+	if (sub)
+		for (i = 0; ss->sel[i].tagset; i++)
+			if (!ss->found[i] && ss->sel[i].tagset == sub)
+				return (TRUE);
+
+	/*
+	 * Keep track of what we pass over, so that callers can tell an
+	 * empty Exif section from one without what they want.  (Fields of
+	 * unknown type would have been discarded anyway.)
+	 */
+
+	if (fvs->ftype[n] >= 0)
+		t->nskip++;
+	return (FALSE);
+}
+
+
+/*
+ * Check off a wanted tag if the property just read is one.  Invalid
+ * properties don't count; there might be a good one later.
+ */
+static void
+selfound(struct exiftags *t)
+{
+	int i;
+	struct exifprop *prop = t->lastprop;
+	struct selscan *ss = (struct selscan *)t->sel;
+
+	if (!prop || prop->lvl == ED_BAD)
+		return;
+
+	for (i = 0; ss->sel[i].tagset; i++)
+		if (!ss->found[i] && ss->sel[i].tagset == prop->tagset &&
+		    ss->sel[i].tag == prop->tag) {
+			ss->found[i] = TRUE;
+			ss->left--;
+		}
+}
+
+
+/*
+ * Decode an IFD's entries with the given loads, a field at a time
+ * across all of them.  Each pass is a simple strided loop, which a
+ * compiler can unroll or vectorize as it sees fit.
+ * XXX Makes dealing with two shorts somewhat messy.
+ */
+#define DECFIELDS(f, n, fvs, ld2, ld4) { \
+	for (i = 0; i < (n); i++) \
+		(fvs)->tags[i] = ld2((f)[i].tag); \
+	for (i = 0; i < (n); i++) \
+		(fvs)->types[i] = ld2((f)[i].type); \
+	for (i = 0; i < (n); i++) \
+		(fvs)->counts[i] = ld4((f)[i].count); \
+	for (i = 0; i < (n); i++) \
+		(fvs)->values[i] = (((fvs)->types[i] == TIFF_SHORT || \
+		    (fvs)->types[i] == TIFF_SSHORT) && \
+		    (fvs)->counts[i] <= 1) ? \
+		    (u_int32_t)ld2((f)[i].value) : ld4((f)[i].value); \
+}
+
+
+/*
+ * Decode all of an IFD's entries into parallel arrays, and look up
+ * their types.  Byte order is fixed for the IFD, so it's checked once
+ * here, and each set of passes has its loads inline.
+ */
+static struct fieldvals *
+decfields(struct ifd *dir, struct exiftags *t)
+{
+	int i, j, n;
+	u_int16_t type;
+	struct field *f;
+	struct fieldvals *fvs;
+	struct exifmem *mem = (struct exifmem *)t->md.mem;
+
+	n = dir->num ? dir->num : 1;
+	fvs = (struct fieldvals *)exifmemalloc(mem, sizeof(struct fieldvals));
+	fvs->tags = (u_int16_t *)exifmemalloc(mem, n * sizeof(u_int16_t));
+	fvs->types = (u_int16_t *)exifmemalloc(mem, n * sizeof(u_int16_t));
+	fvs->counts = (u_int32_t *)exifmemalloc(mem, n * sizeof(u_int32_t));
+	fvs->values = (u_int32_t *)exifmemalloc(mem, n * sizeof(u_int32_t));
+	fvs->ftype = (signed char *)exifmemalloc(mem, n);
+
+	f = dir->fields;
+	n = dir->num;
+	if (dir->md.order == BIG)
+		DECFIELDS(f, n, fvs, EXIF2BE, EXIF4BE)
+	else
+		DECFIELDS(f, n, fvs, EXIF2LE, EXIF4LE)
+
+	/*
+	 * ftypes[] is in type order, so a type is usually right where
+	 * we'd expect it.  Search for it if not.
+	 */
+
+	for (i = 0; i < n; i++) {
+		type = fvs->types[i];
+		if (type && type <= TIFF_DBL && ftypes[type - 1].type == type) {
+			fvs->ftype[i] = (signed char)(type - 1);
+			continue;
+		}
+		for (j = 0; ftypes[j].type && ftypes[j].type != type; j++);
+		fvs->ftype[i] = ftypes[j].type ? (signed char)j : -1;
+	}
+
+	return (fvs);
 }
 
 
@@ -197,8 +351,12 @@ static void
 readtags(struct ifd *dir, int seq, struct exiftags *t, int domkr)
 {
 	int i;
+	struct exifprop *prev = t->lastprop;
+	struct fieldvals *fvs;
+	struct ifdmeta *im = (struct ifdmeta *)t->ifdmd;
+	struct tiffmeta **md;
 
-	if (debug) {
+	if (t->debug) {
 		/* XXX Byte order info can be off for maker notes. */
 		if (dir->par && dir->par->tag != EXIF_T_UNKNOWN) {
 			printf("Processing %s directory, %d entries, "
@@ -212,11 +370,46 @@ readtags(struct ifd *dir, int seq, struct exiftags *t, int domkr)
 			    "little");
 	}
 
-	for (i = 0; i < dir->num; i++)
-		readtag(&(dir->fields[i]), seq, dir, t, domkr);
+	/* Note the IFD's metadata, for its props to find by seq. */
 
-	if (debug)
+	if (!im) {
+		im = (struct ifdmeta *)exifmemalloc(t->md.mem,
+		    sizeof(struct ifdmeta));
+		t->ifdmd = (void *)im;
+	}
+	if (im->num == im->max) {
+		im->max = im->max ? im->max * 2 : 8;
+		md = (struct tiffmeta **)exifmemalloc(t->md.mem,
+		    im->max * sizeof(struct tiffmeta *));
+		if (im->num)
+			memcpy(md, im->md, im->num * sizeof(struct tiffmeta *));
+		im->md = md;
+	}
+	im->md[im->num++] = &dir->md;
+
+	fvs = decfields(dir, t);
+
+	for (i = 0; i < dir->num; i++) {
+		if (!t->sel) {
+			readtag(fvs, i, &(dir->fields[i]), seq, dir, t, domkr);
+			continue;
+		}
+
+		/* Selective scan: only what we want, and stop when done. */
+
+		if (!selfield(fvs, i, dir, t))
+			continue;
+		readtag(fvs, i, &(dir->fields[i]), seq, dir, t, domkr);
+		selfound(t);
+		if (!((struct selscan *)t->sel)->left)
+			break;
+	}
+
+	if (t->debug)
 		printf("\n");
+
+	if (t->visit)
+		visitifd(prev, t, domkr);
 }
 
 
@@ -236,7 +429,6 @@ postprop(struct exifprop *prop, struct exiftags *t)
 	u_int32_t val;
 	float fval;
 	enum byteorder o = t->md.order;
-	struct exifprop *h = t->props;
 
 	/* Skip bad properties. */
 
@@ -275,15 +467,15 @@ postprop(struct exifprop *prop, struct exiftags *t)
 	case EXIF_T_FPXRES:
 	case EXIF_T_FPYRES:
 		if (prop->tag == EXIF_T_XRES || prop->tag == EXIF_T_YRES) {
-			if (!(tmpprop = findprop(h, tags, EXIF_T_RESUNITS)))
+			if (!(tmpprop = findprop(t, tags, EXIF_T_RESUNITS)))
 				break;
 		} else {
-			if (!(tmpprop = findprop(h, tags, EXIF_T_FPRESUNITS)))
+			if (!(tmpprop = findprop(t, tags, EXIF_T_FPRESUNITS)))
 				break;
 		}
 		val = exif4byte(t->md.btiff + prop->value, o) /
 		    exif4byte(t->md.btiff + prop->value + 4, o);
-		snprintf(prop->str, 31, "%d dp%s", val, tmpprop->str);
+		snprintf(prop->str, 31, "%d dp%s", val, propstr(tmpprop, t));
 		prop->str[31] = '\0';
 		break;
 
@@ -366,18 +558,22 @@ postprop(struct exifprop *prop, struct exiftags *t)
 		else
 			v = (u_int16_t)(prop->value & 0x7F);
 
-		exifstralloc(&prop->str, LFLSH);
+		exifstralloc(&prop->str, LFLSH, t);
 
 		/* Don't do anything else if there isn't a flash. */
 
 		if (catdescr(prop->str, flash_func, (u_int16_t)(v & 0x20),
-		    LFLSH))
+		    LFLSH, t))
 			break;
 
-		catdescr(prop->str, flash_fire, (u_int16_t)(v & 0x01), LFLSH);
-		catdescr(prop->str, flash_mode, (u_int16_t)(v & 0x18), LFLSH);
-		catdescr(prop->str, flash_redeye, (u_int16_t)(v & 0x40), LFLSH);
-		catdescr(prop->str, flash_return, (u_int16_t)(v & 0x06), LFLSH);
+		catdescr(prop->str, flash_fire, (u_int16_t)(v & 0x01), LFLSH,
+		    t);
+		catdescr(prop->str, flash_mode, (u_int16_t)(v & 0x18), LFLSH,
+		    t);
+		catdescr(prop->str, flash_redeye, (u_int16_t)(v & 0x40), LFLSH,
+		    t);
+		catdescr(prop->str, flash_return, (u_int16_t)(v & 0x06), LFLSH,
+		    t);
 		break;
 
 	case EXIF_T_FOCALLEN:
@@ -400,7 +596,7 @@ postprop(struct exifprop *prop, struct exiftags *t)
 		break;
 
 	case EXIF_T_FOCALLEN35:
-		exifstralloc(&prop->str, 16);
+		exifstralloc(&prop->str, 16, t);
 		snprintf(prop->str, 15, "%d mm", prop->value);
 		break;
 
@@ -439,24 +635,16 @@ tweaklvl(struct exifprop *prop, struct exiftags *t)
 	}
 
 	/*
-	 * Don't let unprintable characters slip through -- we'll just replace
-	 * them with '_'.  (Can see this with some corrupt maker notes.)
-	 * Remove trailing whitespace while we're at it.
+	 * Clean up ASCII strings (see sanestr()); can see unprintables with
+	 * some corrupt maker notes.  One that's not been formatted yet is
+	 * cleaned up if it ever is.
 	 */
 
-	if (prop->str && prop->type == TIFF_ASCII) {
-		c = prop->str;
-		while (*c) {
-			/* Catch those pesky chars > 127. */
-			if ((unsigned char)*c < ' ')
-				*c = '_';
-			c++;
-		}
-
-		c = prop->str + strlen(prop->str);
-		while (c > prop->str && isspace((int)*(c - 1))) --c;
-		*c = '\0';
-	}
+	if (prop->str && prop->type == TIFF_ASCII &&
+	    !(prop->flags & PR_CONSTSTR))
+		sanestr(prop->str);
+	else if (!prop->str && prop->type == TIFF_ASCII)
+		prop->flags |= PR_SANESTR;
 
 	/*
 	 * IFD1 refers to the thumbnail image; we don't really care.
@@ -470,23 +658,152 @@ tweaklvl(struct exifprop *prop, struct exiftags *t)
 
 	/* Maker tags can override normal Exif tags. */
 
-	if (prop->override && (tmpprop = findprop(t->props, tags,
+	if (prop->override && (tmpprop = findprop(t, tags,
 	    prop->override)))
 		if (tmpprop->lvl & (ED_CAM | ED_IMG | ED_PAS))
 			tmpprop->lvl = ED_OVR;
 }
 
 
+/*
+ * Say whether postprop() or tweaklvl() will look at a property's display
+ * string.  Maker and GPS modules rework theirs in place; otherwise it's
+ * just the few tags postprop() touches, plus ASCII values that might be
+ * printed.  The rest are left for propstr() to format if they're wanted.
+ */
+static int
+needstr(struct exifprop *prop)
+{
+
+	if (prop->lvl == ED_BAD)
+		return (FALSE);
+
+	if (prop->par && prop->par->tagset == tags &&
+	    (prop->par->tag == EXIF_T_MAKERNOTE ||
+	    prop->par->tag == EXIF_T_GPSIFD))
+		return (TRUE);
+
+	if (prop->tagset == tags) {
+		switch (prop->tag) {
+		case EXIF_T_XRES:
+		case EXIF_T_YRES:
+		case EXIF_T_FPXRES:
+		case EXIF_T_FPYRES:
+		case EXIF_T_SHUTTER:
+		case EXIF_T_EXPOSURE:
+		case EXIF_T_FNUMBER:
+		case EXIF_T_LAPERTURE:
+		case EXIF_T_MAXAPERTURE:
+		case EXIF_T_BRIGHTVAL:
+		case EXIF_T_EXPBIASVAL:
+		case EXIF_T_DISTANCE:
+		case EXIF_T_FOCALLEN:
+		case EXIF_T_DIGIZOOM:
+		case EXIF_T_MODEL:
+			return (TRUE);
+		}
+	}
+
+	return (prop->type == TIFF_ASCII &&
+	    (prop->lvl & (ED_CAM | ED_IMG | ED_PAS)));
+}
+
+
+/*
+ * Say whether a visited property has to stay on the list, because
+ * something from a later IFD looks it up: it's the parent of an IFD,
+ * or it's one of the standard tags that post-processing or a maker
+ * module checks.
+ */
+static int
+visitkeep(struct exifprop *prop)
+{
+
+	if (prop->flags & PR_IFDPAR)
+		return (TRUE);
+	if (prop->tagset != tags)
+		return (FALSE);
+
+	switch (prop->tag) {
+	case EXIF_T_RESUNITS:
+	case EXIF_T_FPRESUNITS:
+	case EXIF_T_DISTANCE:
+	case EXIF_T_EXPMODE:
+		return (TRUE);
+	}
+	return (FALSE);
+}
+
+
+/*
+ * Hand the properties just read from an IFD (following prev) to the
+ * visitor.  They get the same treatment as with exifparse(), which is
+ * safe now: what they depend on comes from this IFD or an earlier one.
+ * Standard properties that a maker note might yet override are held
+ * back until the end of the scan, though.  Once visited, the rest are
+ * taken off the list for newprop() to reuse, save the few that later
+ * IFDs need (see visitkeep()).
+ */
+static void
+visitifd(struct exifprop *prev, struct exiftags *t, int domkr)
+{
+	struct exifprop *prop, **pp;
+	struct visitscan *vs = (struct visitscan *)t->visit;
+	struct exifprop **held;
+	int hold;
+
+	for (prop = prev ? prev->next : t->props; prop; prop = prop->next) {
+		if (needstr(prop))
+			propstr(prop, t);
+		postprop(prop, t);
+		tweaklvl(prop, t);
+	}
+
+	pp = prev ? &prev->next : &t->props;
+	t->lastprop = prev;
+	while ((prop = *pp)) {
+		hold = domkr && prop->tagset == tags &&
+		    (prop->lvl & (ED_CAM | ED_IMG | ED_PAS));
+		if (hold) {
+			if (vs->nheld == vs->maxheld) {
+				vs->maxheld = vs->maxheld ?
+				    vs->maxheld * 2 : 16;
+				held = (struct exifprop **)exifmemalloc(
+				    t->md.mem, vs->maxheld *
+				    sizeof(struct exifprop *));
+				if (vs->nheld)
+					memcpy(held, vs->held, vs->nheld *
+					    sizeof(struct exifprop *));
+				vs->held = held;
+			}
+			vs->held[vs->nheld++] = prop;
+		} else if (!vs->stop)
+			vs->stop = vs->fn(prop, t, vs->arg);
+
+		if (hold || visitkeep(prop)) {
+			t->lastprop = prop;
+			pp = &prop->next;
+		} else {
+			*pp = prop->next;
+			prop->next = vs->spare;
+			vs->spare = prop;
+		}
+	}
+
+	/* Nothing may still point at what we've taken off. */
+
+	t->ctx->lastpar = NULL;
+	propreindex(t);
+}
+
+
 /*
  * Fetch the data for an Exif tag.
  */
 static void
 parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 {
-	unsigned int i, len;
-	u_int16_t v = (u_int16_t)prop->value;
-	u_int32_t un, ud, denom;
-	int32_t sn, sd;
+	unsigned int i;
 	char buf[32], *c, *d;
 	struct tiffmeta *md;
 	unsigned char *btiff = dir->md.btiff;
@@ -499,10 +816,8 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 
 	/* Set description if we have a lookup table. */
 
-	for (i = 0; prop->tagset[i].tag < EXIF_T_UNKNOWN &&
-	    prop->tagset[i].tag != prop->tag; i++);
-	if (prop->tagset[i].table) {
-		prop->str = finddescr(prop->tagset[i].table, v);
+	if (prop->def->table) {
+		prop->fmt = PF_DESCR;
 		return;
 	}
 
@@ -547,13 +862,14 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 			if (prop->tag == EXIF_T_INTEROP)
 				break;
 #endif
-			exifwarn2("invalid Exif format: IFD length mismatch",
-			    prop->name);
+			exifnote("invalid Exif format: IFD length mismatch",
+			    prop->name, t);
 			break;
 		}
 
 		/* XXX Doesn't catch multiple IFDs. */
 		dir->next->par = prop;
+		prop->flags |= PR_IFDPAR;
 		return;
 
 	/* Record the Exif version. */
@@ -564,9 +880,7 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 		t->exifmin = (short)atoi(buf + 2);
 		buf[2] = '\0';
 		t->exifmaj = (short)atoi(buf);
-
-		exifstralloc(&prop->str, 8);
-		snprintf(prop->str, 7, "%d.%02d", t->exifmaj, t->exifmin);
+		prop->fmt = PF_VERSION;
 		break;
 
 	/* Process a maker note. */
@@ -591,17 +905,26 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 		 */
 
 		if (makers[t->mkrval].ifdfun) {
-			if (!offsanity(prop, 1, dir))
-				dir->next =
-				    makers[t->mkrval].ifdfun(prop->value, md);
+			if (offsanity(prop, 1, dir))
+				break;
+
+			/* The maker module reads a bit of header first. */
+
+			i = (unsigned int)(md->etiff - md->btiff);
+			i = prop->value < i ? i - prop->value : 0;
+			if (exifincmiss(t->ctx, md->btiff, prop->value,
+			    i < MKRHDRLEN ? i : MKRHDRLEN))
+				break;
+			dir->next = makers[t->mkrval].ifdfun(prop->value, md);
 		} else
-			exifwarn("maker note not supported");
+			exifnote("maker note not supported", NULL, t);
 
 		if (!dir->next)
 			break;
 
 		/* XXX Doesn't catch multiple IFDs. */
 		dir->next->par = prop;
+		prop->flags |= PR_IFDPAR;
 		return;
 
 	/* Lookup functions for maker note. */
@@ -613,8 +936,9 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 		if (offsanity(prop, 1, dir))
 			return;
 
-		strncpy(buf, (const char *)(btiff + prop->value), sizeof(buf));
-		buf[sizeof(buf) - 1] = '\0';
+		i = prop->count < sizeof(buf) ? prop->count : sizeof(buf) - 1;
+		strncpy(buf, (const char *)(btiff + prop->value), i);
+		buf[i] = '\0';
 		for (c = buf; *c; c++) *c = tolower(*c);
 
 		for (i = 0; makers[i].val != EXIF_MKR_UNKNOWN; i++)
@@ -649,7 +973,7 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 		/* Check for a comment type and sane offset. */
 
 		if (prop->count < 8) {
-			exifwarn("invalid user comment length");
+			exifnote("invalid user comment length", NULL, t);
 			prop->lvl = ED_BAD;
 			return;
 		}
@@ -659,9 +983,7 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 
 		/* Ignore the 'comments' WinXP creates when rotating. */
 #ifdef WINXP_BUGS
-		for (i = 0; tags[i].tag < EXIF_T_UNKNOWN &&
-		    tags[i].tag != EXIF_T_USERCOMMENT; i++);
-		if (tags[i].type && tags[i].type != prop->type)
+		if (findtag(tags, EXIF_T_USERCOMMENT, t)->type != prop->type)
 			break;
 #endif
 		/* Lookup the comment type. */
@@ -674,14 +996,13 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 
 		if (ucomment[i].val == TIFF_ASCII) {
 			c = (char *)(btiff + prop->value + 8);
-			d = strlen(c) < prop->count - 8 ? c + strlen(c) :
-			    c + prop->count - 8;
+			if (!(d = (char *)memchr(c, '\0', prop->count - 8)))
+				d = c + prop->count - 8;
 
 			while (d > c && isspace((int)*(d - 1))) --d;
 
-			exifstralloc(&prop->str, d - c + 1);
-			strncpy(prop->str, c, d - c);
-			prop->lvl = prop->str[0] ? ED_IMG : ED_VRB;
+			prop->fmt = PF_COMMENT;
+			prop->lvl = d > c ? ED_IMG : ED_VRB;
 			return;
 		}
 		break;
@@ -691,11 +1012,7 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 		 * This 'undefined' field is one byte; runs afoul of XP
 		 * not zeroing out stuff.
 		 */
-#ifdef WINXP_BUGS
-		prop->str = finddescr(filesrcs, (u_int16_t)(v & 0xFFU));
-#else
-		prop->str = finddescr(filesrcs, v);
-#endif
+		prop->fmt = PF_FILESRC;
 		return;
 	}
 
@@ -704,45 +1021,21 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 	 */
 
 	if (prop->type == TIFF_ASCII) {
-		/* Should fit in the value field. */
-		if (prop->count < 5) {
-			exifstralloc(&prop->str, 5);
-			byte4exif(prop->value, (unsigned char *)prop->str, o);
-			return;
-		}
-
-		/* Sanity check the offset. */
-		if (!offsanity(prop, 1, dir)) {
-			exifstralloc(&prop->str, prop->count + 1);
-			strncpy(prop->str, (const char *)(btiff + prop->value),
-			    prop->count);
-		}
+		/* Should fit in the value field; else sanity check offset. */
+		if (prop->count < 5 || !offsanity(prop, 1, dir))
+			prop->fmt = PF_ASCII;
 		return;
 	}
 
 	/*
-	 * Rational types.  (Note that we'll redo some in our later pass.)
-	 * We'll reduce and simplify the fraction.
+	 * Rational types.  (Formatted as a reduced fraction.)
 	 *
 	 * XXX Misses multiple rationals.
 	 */
 
 	if ((prop->type == TIFF_RTNL || prop->type == TIFF_SRTNL) &&
 	    !offsanity(prop, 8, dir)) {
-
-		exifstralloc(&prop->str, 32);
-
-		if (prop->type == TIFF_RTNL) {
-			un = exif4byte(btiff + prop->value, o);
-			ud = exif4byte(btiff + prop->value + 4, o);
-			denom = gcd(un, ud);
-			fixfract(prop->str, un, ud, denom);
-		} else {
-			sn = exif4sbyte(btiff + prop->value, o);
-			sd = exif4sbyte(btiff + prop->value + 4, o);
-			denom = gcd(abs(sn), abs(sd));
-			fixfract(prop->str, sn, sd, (int32_t)denom);
-		}
+		prop->fmt = PF_RTNL;
 		return;
 	}
 
@@ -758,11 +1051,116 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 
 	if ((prop->type == TIFF_SHORT || prop->type == TIFF_SSHORT) &&
 	    prop->count > 2 && !offsanity(prop, 2, dir)) {
+		if (prop->count <= 8)
+			prop->fmt = PF_SHORTS;
+		return;
+	}
+	return;
+}
 
-		if (prop->count > 8)
-			return;
+
+/*
+ * Don't let unprintable characters slip through -- we'll just replace
+ * them with '_'.  Remove trailing whitespace while we're at it.
+ */
+static void
+sanestr(char *s)
+{
+	char *c;
+
+	for (c = s; *c; c++)
+		*c = EXIF_SANE(*c);	/* Catch those pesky chars > 127. */
+
+	while (c > s && isspace((int)*(c - 1))) --c;
+	*c = '\0';
+}
+
+
+/*
+ * Build the display string that parsetag() left for later.  The checks
+ * on offsets and such were made then, so we just format here.
+ */
+static void
+fmtprop(struct exifprop *prop, struct exiftags *t)
+{
+	unsigned int i, len;
+	u_int16_t v = (u_int16_t)prop->value;
+	u_int32_t un, ud, denom;
+	int32_t sn, sd;
+	char *c, *d;
+	struct tiffmeta *md = propmd(prop, t);
+	unsigned char *btiff = md->btiff;
+	enum byteorder o = md->order;
+
+	switch (prop->fmt) {
+
+	case PF_DESCR:
+		descrprop(prop, prop->def->table, v, t);
+		break;
+
+	case PF_VERSION:
+		exifstralloc(&prop->str, 8, t);
+		snprintf(prop->str, 7, "%d.%02d", t->exifmaj, t->exifmin);
+		break;
+
+	/* ASCII user comment; strip any trailing whitespace. */
+
+	case PF_COMMENT:
+		c = (char *)(btiff + prop->value + 8);
+		if (!(d = (char *)memchr(c, '\0', prop->count - 8)))
+			d = c + prop->count - 8;
+
+		while (d > c && isspace((int)*(d - 1))) --d;
+
+		exifstralloc(&prop->str, d - c + 1, t);
+		strncpy(prop->str, c, d - c);
+		break;
+
+	case PF_FILESRC:
+#ifdef WINXP_BUGS
+		descrprop(prop, filesrcs, (u_int16_t)(v & 0xFFU), t);
+#else
+		descrprop(prop, filesrcs, v, t);
+#endif
+		break;
+
+	case PF_ASCII:
+		if (prop->count < 5) {
+			exifstralloc(&prop->str, 5, t);
+			byte4exif(prop->value, (unsigned char *)prop->str, o);
+		} else {
+			exifstralloc(&prop->str, prop->count + 1, t);
+			strncpy(prop->str, (const char *)(btiff + prop->value),
+			    prop->count);
+		}
+		if (prop->flags & PR_SANESTR)
+			sanestr(prop->str);
+		break;
+
+	/*
+	 * Rational types.  (Note that we'll redo some in our later pass.)
+	 * We'll reduce and simplify the fraction.
+	 */
+
+	case PF_RTNL:
+		exifstralloc(&prop->str, 32, t);
+
+		if (prop->type == TIFF_RTNL) {
+			un = exif4byte(btiff + prop->value, o);
+			ud = exif4byte(btiff + prop->value + 4, o);
+			denom = gcd(un, ud);
+			fixfract(prop->str, un, ud, denom);
+		} else {
+			sn = exif4sbyte(btiff + prop->value, o);
+			sd = exif4sbyte(btiff + prop->value + 4, o);
+			denom = gcd(abs(sn), abs(sd));
+			fixfract(prop->str, sn, sd, (int32_t)denom);
+		}
+		break;
+
+	case PF_SHORTS:
 		len = 8 * prop->count + 1;
-		exifstralloc(&prop->str, len);
+		exifstralloc(&prop->str, len, t);
 
 		for (i = 0; i < prop->count; i++) {
 			if (prop->type == TIFF_SHORT)
@@ -777,69 +1175,594 @@ parsetag(struct exifprop *prop, struct ifd *dir, struct exiftags *t, int domkr)
 				    (i * 2), o));
 		}
 		prop->str[strlen(prop->str) - 2] = '\0';
-		return;
+		break;
 	}
-	return;
 }
 
 
 /*
- * Delete dynamic Exif property and IFD memory.
+ * Return a property's display string, formatting it on first use.
+ * Can be NULL if the property has no string representation (or, with
+ * the context's error set, if there wasn't memory for one).
+ */
+char *
+propstr(struct exifprop *prop, struct exiftags *t)
+{
+	jmp_buf fail;
+	struct exifctx *ctx = t->ctx;
+
+	if (prop->fmt) {
+		if (!prop->str && ctx->fail)
+			fmtprop(prop, t);
+		else if (!prop->str) {
+			/* Called after the parse; catch failures here. */
+
+			if (setjmp(fail)) {
+				ctx->fail = NULL;
+				prop->str = NULL;
+				prop->fmt = PF_NONE;
+				return (NULL);
+			}
+			ctx->fail = (void *)&fail;
+			fmtprop(prop, t);
+			ctx->fail = NULL;
+		}
+		prop->fmt = PF_NONE;
+	}
+	return (prop->str);
+}
+
+
+/*
+ * Return a read-only view of an ASCII property or ASCII user comment,
+ * setting len to its length with trailing whitespace dropped.  If the
+ * string hasn't been formatted yet, the view points straight into the
+ * Exif buffer, so it's good only as long as that is, isn't nul-terminated,
+ * and no copy is made.  Display code wanting tweaklvl()'s treatment of
+ * unprintables can pass each character through EXIF_SANE().  Other
+ * properties get their display string.  Can be NULL.
+ */
+const char *
+propview(struct exifprop *prop, struct exiftags *t, int *len)
+{
+	const char *c, *d;
+	unsigned char *btiff;
+
+	*len = 0;
+	btiff = prop->fmt ? propmd(prop, t)->btiff : NULL;
+
+	if (!prop->str && prop->fmt == PF_ASCII && prop->count >= 5) {
+		c = (const char *)(btiff + prop->value);
+		d = memchr(c, '\0', prop->count);
+		if (!d)
+			d = c + prop->count;
+	} else if (!prop->str && prop->fmt == PF_COMMENT) {
+		c = (const char *)(btiff + prop->value + 8);
+		d = memchr(c, '\0', prop->count - 8);
+		if (!d)
+			d = c + prop->count - 8;
+	} else {
+		if (!(c = propstr(prop, t)))
+			return (NULL);
+		d = c + strlen(c);
+		if (prop->type != TIFF_ASCII) {
+			*len = d - c;
+			return (c);
+		}
+	}
+
+	while (d > c && isspace((int)*(d - 1))) --d;
+	*len = d - c;
+	return (c);
+}
+
+
+/*
+ * Typed access to property values, straight from the TIFF data rather
+ * than by way of the display strings.  Each returns true if the value
+ * is there and fits; false otherwise (e.g., wrong type, index out of
+ * range, or a bad offset).  Values i are counted from zero.  Child
+ * properties made by maker modules have just their one value.
+ */
+
+/*
+ * Find where a property's ith value of size bytes lives.  Values of up
+ * to four bytes altogether are packed into the field itself (and so
+ * into prop->value), which we lay back out in raw.
+ */
+static unsigned char *
+propdata(struct exifprop *prop, struct tiffmeta *md, u_int32_t i,
+    size_t size, unsigned char *raw)
+{
+	u_int32_t tifflen;
+
+	if (!md || i >= prop->count)
+		return (NULL);
+	if (prop->count <= 4 / size) {
+		byte4exif(prop->value, raw, md->order);
+		return (raw + i * size);
+	}
+
+	tifflen = md->etiff - md->btiff;
+	if (prop->value > tifflen || (i + 1) > (tifflen - prop->value) / size)
+		return (NULL);
+	return (md->btiff + prop->value + i * size);
+}
+
+
+/*
+ * Fetch a property's ith integer value, sign-extended if it's a signed
+ * type (and noting that in sgn).
+ */
+static int
+propraw(struct exifprop *prop, struct exiftags *t, u_int32_t i, u_int32_t *v,
+    int *sgn)
+{
+	unsigned char raw[4], *b;
+	struct tiffmeta *md;
+	enum byteorder o;
+
+	*sgn = (prop->type == TIFF_SBYTE || prop->type == TIFF_SSHORT ||
+	    prop->type == TIFF_SLONG);
+
+	/* Maker children, and shorts that have been read already. */
+
+	if (prop->type == TIFF_UNKN || ((prop->type == TIFF_SHORT ||
+	    prop->type == TIFF_SSHORT) && prop->count == 1)) {
+		if (i)
+			return (FALSE);
+		*v = prop->value;
+		if (prop->type == TIFF_SSHORT)
+			*v = (u_int32_t)(int32_t)(int16_t)*v;
+		return (TRUE);
+	}
+
+	md = propmd(prop, t);
+	o = md ? md->order : BIG;
+	switch (prop->type) {
+	case TIFF_BYTE:
+	case TIFF_SBYTE:
+		if (!(b = propdata(prop, md, i, 1, raw)))
+			return (FALSE);
+		*v = prop->type == TIFF_SBYTE ?
+		    (u_int32_t)(int32_t)(signed char)*b : *b;
+		return (TRUE);
+	case TIFF_SHORT:
+		if (!(b = propdata(prop, md, i, 2, raw)))
+			return (FALSE);
+		*v = exif2byte(b, o);
+		return (TRUE);
+	case TIFF_SSHORT:
+		if (!(b = propdata(prop, md, i, 2, raw)))
+			return (FALSE);
+		*v = (u_int32_t)(int32_t)exif2sbyte(b, o);
+		return (TRUE);
+	case TIFF_LONG:
+	case TIFF_SLONG:
+		if (!(b = propdata(prop, md, i, 4, raw)))
+			return (FALSE);
+		*v = exif4byte(b, o);
+		return (TRUE);
+	}
+	return (FALSE);
+}
+
+
+/*
+ * Integer values (of any of the integer types).
+ */
+int
+propint(struct exifprop *prop, struct exiftags *t, u_int32_t i, int32_t *v)
+{
+	u_int32_t n;
+	int sgn;
+
+	if (!propraw(prop, t, i, &n, &sgn) || (!sgn && n > 0x7fffffff))
+		return (FALSE);
+	*v = (int32_t)n;
+	return (TRUE);
+}
+
+int
+propuint(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    u_int32_t *v)
+{
+	u_int32_t n;
+	int sgn;
+
+	if (!propraw(prop, t, i, &n, &sgn) || (sgn && (int32_t)n < 0))
+		return (FALSE);
+	*v = n;
+	return (TRUE);
+}
+
+
+/*
+ * Fill v with up to n of a property's integer values, returning how
+ * many it got.
+ */
+u_int32_t
+propints(struct exifprop *prop, struct exiftags *t, int32_t *v, u_int32_t n)
+{
+	u_int32_t i;
+
+	for (i = 0; i < n && propint(prop, t, i, v + i); i++);
+	return (i);
+}
+
+u_int32_t
+propuints(struct exifprop *prop, struct exiftags *t, u_int32_t *v,
+    u_int32_t n)
+{
+	u_int32_t i;
+
+	for (i = 0; i < n && propuint(prop, t, i, v + i); i++);
+	return (i);
+}
+
+
+/*
+ * Rational values, as numerator and denominator.  (Unsigned ones that
+ * fit are fine as signed, and vice versa.)
+ */
+int
+proprtnl(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    u_int32_t *num, u_int32_t *den)
+{
+	unsigned char *b;
+	struct tiffmeta *md;
+
+	if (prop->type != TIFF_RTNL && prop->type != TIFF_SRTNL)
+		return (FALSE);
+	md = propmd(prop, t);
+	if (!(b = propdata(prop, md, i, 8, NULL)))
+		return (FALSE);
+	*num = exif4byte(b, md->order);
+	*den = exif4byte(b + 4, md->order);
+	if (prop->type == TIFF_SRTNL &&
+	    ((int32_t)*num < 0 || (int32_t)*den < 0))
+		return (FALSE);
+	return (TRUE);
+}
+
+int
+propsrtnl(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    int32_t *num, int32_t *den)
+{
+	unsigned char *b;
+	struct tiffmeta *md;
+
+	if (prop->type != TIFF_RTNL && prop->type != TIFF_SRTNL)
+		return (FALSE);
+	md = propmd(prop, t);
+	if (!(b = propdata(prop, md, i, 8, NULL)))
+		return (FALSE);
+	*num = exif4sbyte(b, md->order);
+	*den = exif4sbyte(b + 4, md->order);
+	if (prop->type == TIFF_RTNL && (*num < 0 || *den < 0))
+		return (FALSE);
+	return (TRUE);
+}
+
+
+/*
+ * Any numeric value as a double.  Rationals with a zero denominator
+ * don't count.  (Floats and doubles are assumed to be IEEE, like ours.)
+ */
+int
+propdbl(struct exifprop *prop, struct exiftags *t, u_int32_t i, double *v)
+{
+	struct tiffmeta *md;
+	unsigned char raw[4], host[8], *b;
+	u_int32_t n, d;
+	int32_t sn, sd;
+	float f;
+	int j, sgn, size;
+
+	switch (prop->type) {
+	case TIFF_RTNL:
+		if (!proprtnl(prop, t, i, &n, &d) || !d)
+			return (FALSE);
+		*v = (double)n / (double)d;
+		return (TRUE);
+	case TIFF_SRTNL:
+		if (!propsrtnl(prop, t, i, &sn, &sd) || !sd)
+			return (FALSE);
+		*v = (double)sn / (double)sd;
+		return (TRUE);
+	case TIFF_FLOAT:
+	case TIFF_DBL:
+		size = prop->type == TIFF_FLOAT ? 4 : 8;
+		md = propmd(prop, t);
+		if (!(b = propdata(prop, md, i, size, raw)))
+			return (FALSE);
+
+		/* Get the bytes into our order. */
+
+		n = 1;
+		if ((*(unsigned char *)&n == 1) == (md->order == LITTLE))
+			memcpy(host, b, size);
+		else
+			for (j = 0; j < size; j++)
+				host[j] = b[size - 1 - j];
+		if (size == 4) {
+			memcpy(&f, host, 4);
+			*v = (double)f;
+		} else
+			memcpy(v, host, 8);
+		return (TRUE);
+	}
+
+	if (!propraw(prop, t, i, &n, &sgn))
+		return (FALSE);
+	*v = sgn ? (double)(int32_t)n : (double)n;
+	return (TRUE);
+}
+
+
+/*
+ * Read a number from a date & time, as sscanf()'s %d would: leading
+ * whitespace, an optional sign, and digits.  (Digits past the ninth are
+ * passed over, so that it can't overflow.)
+ */
+static int
+tmfield(const unsigned char **c, const unsigned char *e, int *v)
+{
+	const unsigned char *d;
+	int neg;
+
+	while (*c < e && isspace((int)**c)) ++*c;
+	neg = FALSE;
+	if (*c < e && (**c == '-' || **c == '+'))
+		neg = (*(*c)++ == '-');
+	for (d = *c, *v = 0; *c < e && isdigit((int)**c); ++*c)
+		if (*c - d < 9)
+			*v = *v * 10 + (**c - '0');
+	if (neg)
+		*v = -*v;
+	return (*c > d);
+}
+
+
+/*
+ * A date & time ("YYYY:MM:DD HH:MM:SS", e.g., DateTimeOriginal) as a
+ * broken-down time.  It's read the way sscanf("%d:%d:%d %d:%d:%d")
+ * would, so fields may be short, padded with whitespace, or signed;
+ * all six have to be there.
+ */
+int
+proptm(struct exifprop *prop, struct exiftags *t, struct tm *tm)
+{
+	static const char sep[] = ":: ::";
+	const unsigned char *c, *e;
+	unsigned char raw[4];
+	int i, v[6];
+
+	if (prop->type != TIFF_ASCII || !prop->count)
+		return (FALSE);
+	if (!(c = propdata(prop, propmd(prop, t), prop->count - 1, 1,
+	    raw)))
+		return (FALSE);
+	e = c + 1;
+	c -= prop->count - 1;
+
+	for (i = 0; i < 6; i++) {
+		if (!tmfield(&c, e, &v[i]))
+			return (FALSE);
+		if (i < 5 && sep[i] != ' ') {
+			if (c == e || *c != sep[i])
+				return (FALSE);
+			c++;
+		}
+	}
+
+	memset(tm, 0, sizeof(struct tm));
+	tm->tm_year = v[0] - 1900;
+	tm->tm_mon = v[1] - 1;
+	tm->tm_mday = v[2];
+	tm->tm_hour = v[3];
+	tm->tm_min = v[4];
+	tm->tm_sec = v[5];
+	return (TRUE);
+}
+
+
+/*
+ * Delete dynamic Exif property and IFD memory.  Everything, including
+ * the exiftags structure itself, lives in the parse arenas, which belong
+ * to a context.  If the context was created for this parse alone, it
+ * goes; otherwise the arenas are left as they are, along with the
+ * diagnostics in them, until the context's next parse trims them back.
  */
 void
 exiffree(struct exiftags *t)
 {
-	struct exifprop *tmpprop;
-	struct ifdoff *tmpoff;
 
-	if (!t) return;
+	if (t && t->ctx->tmp)
+		exifctxfree(t->ctx);
+}
+
+
+/*
+ * The default allocator: libc's.
+ */
+static void *
+stdalloc(size_t len, void *arg)
+{
+
+	(void)arg;
+	return (malloc(len));
+}
+
+static void
+stdrelease(void *p, void *arg)
+{
+
+	(void)arg;
+	free(p);
+}
+
+static const struct exifalloc stdmem = { stdalloc, stdrelease, NULL };
+
 
-	while ((tmpprop = t->props)) {
-		if (t->props->str) free(t->props->str);
-		t->props = t->props->next;
-		free(tmpprop);
+/*
+ * Create a parse context.  Returns NULL if there's no memory for it.
+ */
+struct exifctx *
+exifctxnew(void)
+{
+
+	return (exifctxnewalloc(&stdmem));
+}
+
+
+/*
+ * Create a parse context whose memory comes from the given allocator.
+ * (It's copied; NULL means libc's.)
+ */
+struct exifctx *
+exifctxnewalloc(const struct exifalloc *alloc)
+{
+	struct exifctx *ctx;
+
+	if (!alloc)
+		alloc = &stdmem;
+	/* The table index cache follows the context. */
+
+	ctx = (struct exifctx *)alloc->alloc(sizeof(struct exifctx) +
+	    sizeof(struct tblcache), alloc->arg);
+	if (!ctx)
+		return (NULL);
+	memset(ctx, 0, sizeof(struct exifctx) + sizeof(struct tblcache));
+	ctx->alloc = *alloc;
+	ctx->keep = EXIFCTXKEEP;
+	ctx->debug = FALSE;
+	ctx->error = EXIF_OK;
+	ctx->mem = (void *)exifmemnew(ctx);
+	ctx->propmem = (void *)exifmemnew(ctx);
+	ctx->tblcache = (void *)(ctx + 1);
+	if (!ctx->mem || !ctx->propmem) {
+		exifctxfree(ctx);
+		return (NULL);
 	}
-	while ((tmpoff = (struct ifdoff *)(t->md.ifdoffs))) {
-		t->md.ifdoffs = (void *)tmpoff->next;
-		free(tmpoff);
+	return (ctx);
+}
+
+
+/*
+ * Reset a parse context between files, releasing the last parse and
+ * giving back memory beyond what the context keeps.
+ */
+void
+exifctxreset(struct exifctx *ctx)
+{
+
+	exifmemtrim((struct exifmem *)ctx->propmem, ctx->keep);
+	exifmemtrim((struct exifmem *)ctx->mem, ctx->keep);
+	ctx->diags = ctx->lastdiag = NULL;
+	ctx->error = EXIF_OK;
+	ctx->needoff = ctx->needlen = 0;
+	incfree(ctx);
+	if (ctx->bufsz > ctx->keep) {
+		freemem(ctx, ctx->buf);
+		ctx->buf = NULL;
+		ctx->bufsz = 0;
 	}
-	free(t);
 }
 
 
 /*
- * Scan the Exif section.
+ * Free a parse context and everything it holds.
  */
-struct exiftags *
-exifscan(unsigned char *b, int len, int domkr)
+void
+exifctxfree(struct exifctx *ctx)
+{
+
+	if (!ctx) return;
+	incfree(ctx);
+	exifmemfree((struct exifmem *)ctx->propmem);
+	exifmemfree((struct exifmem *)ctx->mem);
+	freemem(ctx, ctx->buf);
+	freemem(ctx, ctx);
+}
+
+
+/*
+ * Return a context's APP1 buffer, grown to at least len bytes.  Its
+ * contents don't survive growing.  Returns NULL (with the context's
+ * error set) if there's no memory for it.
+ */
+unsigned char *
+exifctxbuf(struct exifctx *ctx, size_t len)
+{
+
+	if (len > ctx->bufsz) {
+		freemem(ctx, ctx->buf);
+		ctx->bufsz = 0;
+		if (!(ctx->buf = (unsigned char *)allocmem(ctx, len))) {
+			ctx->error = EXIF_ENOMEM;
+			return (NULL);
+		}
+		ctx->bufsz = len;
+	}
+	return (ctx->buf);
+}
+
+
+/*
+ * Scan the Exif section, optionally for just a selection of tags.
+ */
+static struct exiftags *
+scan(struct exifctx *ctx, unsigned char *b, int len, int domkr,
+    struct exifsel *sel, struct visitscan *vs)
 {
 	int seq;
 	u_int32_t ifdoff;
 	struct exiftags *t;
-	struct ifd *curifd, *tmpifd;
+	struct exifmem *mem;
+	struct ifd *curifd;
+	struct selscan *ss;
 
-	/* Create and initialize our file info structure. */
+	/*
+	 * Create and initialize our file info structure.  It's the first
+	 * thing carved out of the arena that holds the rest of the parse.
+	 * (Props get an arena of their own, so that the records sit
+	 * together rather than scattered among their strings.)
+	 */
 
-	t = (struct exiftags *)malloc(sizeof(struct exiftags));
-	if (!t) {
-		exifwarn2("can't allocate file info",
-		    (const char *)strerror(errno));
-		return (NULL);
-	}
-	memset(t, 0, sizeof(struct exiftags));
+	mem = (struct exifmem *)ctx->mem;
+	t = (struct exiftags *)exifmemalloc(mem, sizeof(struct exiftags));
+	t->md.mem = (void *)mem;
+	t->md.t = t;
+	t->propmem = ctx->propmem;
+	t->ctx = ctx;
+	t->tblcache = ctx->tblcache;
+	t->debug = ctx->debug;
+	ctx->cur = t;
+
+	if (sel) {
+		ss = (struct selscan *)exifmemalloc(mem,
+		    sizeof(struct selscan));
+		for (ss->left = 0; sel[ss->left].tagset; ss->left++);
+		ss->sel = sel;
+		ss->found = (unsigned char *)exifmemalloc(mem,
+		    ss->left ? ss->left : 1);
+		t->sel = (void *)ss;
+	} else
+		ss = NULL;
+	t->visit = (void *)vs;
 
 	seq = 0;
 	t->md.etiff = b + len;	/* End of TIFF. */
 
 	/*
 	 * Make sure we've got the proper Exif header.  If not, we're
-	 * looking at somebody else's APP1 (e.g., Photoshop).
+	 * looking at somebody else's APP1 (e.g., Photoshop).  (Or, if
+	 * it's coming in pieces, it might not be here yet.)
 	 */
 
-	if (memcmp(b, "Exif\0\0", 6)) {
-		exiffree(t);
+	if (exifincmiss(ctx, b, 0, 14) || memcmp(b, "Exif\0\0", 6))
 		return (NULL);
-	}
 	b += 6;
 
 	/* Determine endianness of the TIFF data. */
@@ -849,8 +1772,7 @@ exifscan(unsigned char *b, int len, int domkr)
 	else if (!memcmp(b, "II", 2))
 		t->md.order = LITTLE;
 	else {
-		exifwarn("invalid TIFF header");
-		exiffree(t);
+		exiffail(ctx, EXIF_EFORMAT, "invalid TIFF header");
 		return (NULL);
 	}
 
@@ -860,8 +1782,7 @@ exifscan(unsigned char *b, int len, int domkr)
 	/* Verify the TIFF header. */
 
 	if (exif2byte(b, t->md.order) != 42) {
-		exifwarn("invalid TIFF header");
-		exiffree(t);
+		exiffail(ctx, EXIF_EFORMAT, "invalid TIFF header");
 		return (NULL);
 	}
 	b += 2;
@@ -871,17 +1792,16 @@ exifscan(unsigned char *b, int len, int domkr)
 	ifdoff = exif4byte(b, t->md.order);
 	curifd = readifds(ifdoff, tags, &t->md);
 	if (!curifd) {
-		exifwarn("invalid Exif format (couldn't read IFD0)");
-		exiffree(t);
+		exiffail(ctx, EXIF_EFORMAT,
+		    "invalid Exif format (couldn't read IFD0)");
 		return (NULL);
 	}
 
 	/* Now, let's parse the fields... */
 
-	while ((tmpifd = curifd)) {
+	while (curifd && (!ss || ss->left) && (!vs || !vs->stop)) {
 		readtags(curifd, seq++, t, domkr);
 		curifd = curifd->next;
-		free(tmpifd);		/* No need to keep it around... */
 	}
 
 	return (t);
@@ -889,27 +1809,232 @@ exifscan(unsigned char *b, int len, int domkr)
 
 
 /*
- * Read the Exif section and prepare the data for output.
+ * Make field values pretty.  Only the display strings that post-processing
+ * and level tweaks work from are formatted here (see needstr()).
  */
-struct exiftags *
-exifparse(unsigned char *b, int len)
+static void
+prettify(struct exiftags *t)
 {
-	struct exiftags *t;
 	struct exifprop *curprop;
 
-	/* Find the section and scan it. */
-
-	if (!(t = exifscan(b, len, TRUE)))
-		return (NULL);
-
-	/* Make field values pretty. */
-
 	curprop = t->props;
 	while (curprop) {
+		if (needstr(curprop))
+			propstr(curprop, t);
 		postprop(curprop, t);
 		tweaklvl(curprop, t);
 		curprop = curprop->next;
 	}
+}
+
+
+/*
+ * Finish up a scan: make it pretty, if asked, and let a visitor see
+ * whatever it hasn't yet (what was held back for the end).  Maker
+ * modules do some of their work here, so we can still hit a limit.
+ */
+static struct exiftags *
+finish(struct exifctx *ctx, struct exiftags *t, int pretty,
+    struct visitscan *vs)
+{
+	jmp_buf fail;
+	u_int32_t i;
+
+	if (setjmp(fail)) {
+		ctx->fail = NULL;
+		return (ctx->error == EXIF_ELIMIT ? t : NULL);
+	}
+	ctx->fail = (void *)&fail;
+
+	if (pretty)
+		prettify(t);
+	if (vs)
+		for (i = 0; i < vs->nheld && !vs->stop; i++)
+			vs->stop = vs->fn(vs->held[i], t, vs->arg);
+
+	ctx->fail = NULL;
+	return (t);
+}
+
+
+/*
+ * Run a parse with a context.  Whatever the last parse left in it is
+ * dropped first.  Failures anywhere below come back here (see
+ * exiffail()), and we return NULL with the context's error set --
+ * except when the parse hits one of the context's limits, in which case
+ * we finish with what we've got.
+ */
+static struct exiftags *
+run(struct exifctx *ctx, unsigned char *b, int len, int domkr,
+    struct exifsel *sel, int pretty, struct visitscan *vs)
+{
+	jmp_buf fail;
+	struct exiftags *t;
+
+	exifmemtrim((struct exifmem *)ctx->mem, ctx->keep);
+	exifmemtrim((struct exifmem *)ctx->propmem, ctx->keep);
+	ctx->diags = ctx->lastdiag = NULL;
+	ctx->faildiag.msg = NULL;
+	ctx->error = EXIF_OK;
+	if (ctx->inc && !((struct incscan *)ctx->inc)->running)
+		incfree(ctx);
+	memset(&ctx->used, 0, sizeof(struct exiflimits));
+	if (ctx->limits.msecs)
+		ctx->used.msecs = exifmsecs();
+	ctx->lastpar = NULL;
+	ctx->cur = NULL;
+
+	if (setjmp(fail)) {
+		ctx->fail = NULL;
+		t = ctx->error == EXIF_ELIMIT ? ctx->cur : NULL;
+	} else {
+		ctx->fail = (void *)&fail;
+		t = scan(ctx, b, len, domkr, sel, vs);
+		ctx->fail = NULL;
+	}
+	if (t)
+		t = finish(ctx, t, pretty, vs);
+
+	/* The parse is over; its limits no longer apply (see exiflimit()). */
+
+	ctx->cur = NULL;
+	return (t);
+}
+
+
+/*
+ * Run a parse with a context of its own, for the calls that don't take
+ * one.  The context goes away with exiffree() (or now, if there's
+ * nothing to return).
+ */
+static struct exiftags *
+runtmp(unsigned char *b, int len, int domkr, struct exifsel *sel,
+    int pretty)
+{
+	struct exifctx *ctx;
+	struct exiftags *t;
 
+	if (!(ctx = exifctxnew()))
+		return (NULL);
+	ctx->tmp = TRUE;
+	if (!(t = run(ctx, b, len, domkr, sel, pretty, NULL)))
+		exifctxfree(ctx);
 	return (t);
 }
+
+
+/*
+ * Scan the Exif section.
+ */
+struct exiftags *
+exifscan(unsigned char *b, int len, int domkr)
+{
+
+	return (runtmp(b, len, domkr, NULL, FALSE));
+}
+
+
+/*
+ * Scan the Exif section for a list of wanted tags.  Only those tags are
+ * decoded (along with the IFD pointers needed to reach them), and the
+ * scan stops once they've all been found.  Maker notes aren't read.
+ */
+struct exiftags *
+exifscansel(unsigned char *b, int len, struct exifsel *sel)
+{
+
+	return (runtmp(b, len, FALSE, sel, FALSE));
+}
+
+
+/*
+ * Like exifscan() and exifscansel(), but using a parse context's memory.
+ * The result is good until the context's next parse.
+ */
+struct exiftags *
+exifctxscan(struct exifctx *ctx, unsigned char *b, int len, int domkr)
+{
+
+	return (run(ctx, b, len, domkr, NULL, FALSE, NULL));
+}
+
+struct exiftags *
+exifctxscansel(struct exifctx *ctx, unsigned char *b, int len,
+    struct exifsel *sel)
+{
+
+	return (run(ctx, b, len, FALSE, sel, FALSE, NULL));
+}
+
+
+/*
+ * Read the Exif section and prepare the data for output.  Display
+ * strings are built as they're needed, so get them with propstr().
+ */
+struct exiftags *
+exifparse(unsigned char *b, int len)
+{
+
+	return (runtmp(b, len, TRUE, NULL, TRUE));
+}
+
+
+/*
+ * Like exifparse(), but using a parse context's memory.
+ */
+struct exiftags *
+exifctxparse(struct exifctx *ctx, unsigned char *b, int len)
+{
+
+	return (run(ctx, b, len, TRUE, NULL, TRUE, NULL));
+}
+
+
+/*
+ * Read the Exif section like exifparse(), but rather than building up
+ * a property list for the caller, hand each property to fn as soon as
+ * it's done.  (A few standard ones wait for the end of the section, in
+ * case a maker note overrides them.)  If fn returns non-zero, we stop.
+ * The properties are good only until fn returns; with a context, until
+ * its next parse.  Returns EXIF_OK or an error, with the parse's diags
+ * left in the context; properties seen before an error are still
+ * visited.
+ *
+ * No property list is built up: once an IFD's properties have been
+ * visited, their records are reused for the next IFD's, so a visit
+ * holds about one IFD's worth at a time.  Kept to the end are just
+ * those held back and the few that later ones are worked out from
+ * (IFD parents, resolution units, and tags the maker modules check).
+ * Display strings that fn asks for with propstr() do stay until the
+ * end, though.
+ */
+int
+exifctxvisit(struct exifctx *ctx, unsigned char *b, int len,
+    int (*fn)(struct exifprop *, struct exiftags *, void *), void *arg)
+{
+	struct visitscan vs;
+
+	vs.fn = fn;
+	vs.arg = arg;
+	vs.held = NULL;
+	vs.nheld = vs.maxheld = 0;
+	vs.spare = NULL;
+	vs.stop = FALSE;
+
+	(void)run(ctx, b, len, TRUE, NULL, FALSE, &vs);
+	return (ctx->error);
+}
+
+int
+exifvisit(unsigned char *b, int len,
+    int (*fn)(struct exifprop *, struct exiftags *, void *), void *arg)
+{
+	struct exifctx *ctx;
+	int rc;
+
+	if (!(ctx = exifctxnew()))
+		return (EXIF_ENOMEM);
+	rc = exifctxvisit(ctx, b, len, fn, arg);
+	exifctxfree(ctx);
+	return (rc);
+}
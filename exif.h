@@ -45,6 +45,7 @@
 #define _EXIF_H
 
 #include <sys/types.h>
+#include <time.h>
 
 
 /*
@@ -107,6 +108,11 @@ typedef __int32 int32_t;
 #define ED_BAD	0x40	/* 'Bad' or incorrect info (given other values). */
 
 
+/* Unprintable characters in ASCII values are shown as '_'. */
+
+#define EXIF_SANE(c)	((unsigned char)(c) < ' ' ? '_' : (c))
+
+
 /* Interesting tags. */
 
 #define EXIF_T_UNKNOWN		0xffff		/* XXX Non-standard. */
@@ -187,20 +193,26 @@ struct exiftag {
 };
 
 
-/* Final Exif property info.  (Note: descr can be NULL.) */
+/*
+ * Final Exif property info.  (Note: descr can be NULL.)  The fields
+ * checked on every pass over the list are packed up front.
+ */
 
 struct exifprop {
 	u_int16_t tag;		/* The Exif tag. */
 	u_int16_t type;
+	unsigned short lvl;	/* Verbosity level. */
+	u_int16_t override;	/* Override display of another tag. */
 	u_int32_t count;
 	u_int32_t value;
+	int ifdseq;		/* Sequence number of parent IFD. */
+	u_int16_t fmt;		/* Pending str format (internal only). */
+	u_int16_t flags;	/* Property flags (internal only). */
 	const char *name;
 	const char *descr;
 	char *str;		/* String representation of value (dynamic). */
-	unsigned short lvl;	/* Verbosity level. */
-	int ifdseq;		/* Sequence number of parent IFD. */
-	u_int16_t override;	/* Override display of another tag. */
 	struct exiftag *tagset;	/* Tags used to create property. */
+	struct exiftag *def;	/* Tag definition within tagset. */
 	struct exifprop *par;	/* Parent property association. */
 	struct exifprop *next;
 };
@@ -225,6 +237,116 @@ struct tiffmeta {
 	unsigned char *btiff;	/* Beginning of TIFF (offset base). */
 	unsigned char *etiff;	/* End of TIFF. */
 	void *ifdoffs;		/* List of IFD offsets (internal only). */
+	void *mem;		/* Parse memory arena (internal only). */
+	struct exiftags *t;	/* Parse we belong to (internal only). */
+};
+
+
+/*
+ * A tag wanted from exifscansel().  Lists of them end with an entry
+ * whose tagset is NULL.
+ */
+
+struct exifsel {
+	struct exiftag *tagset;	/* Tag set the tag belongs to. */
+	u_int16_t tag;		/* The Exif tag. */
+};
+
+
+/*
+ * Parse results.  The library doesn't print anything or exit; failures
+ * are returned as one of these codes, and whatever a parse has to say
+ * along the way is collected as a list of diagnostic records.  The
+ * strings in a record are constant or belong to the parse, so they're
+ * good until the context's next parse.
+ */
+
+#define EXIF_OK		0	/* No error. */
+#define EXIF_ENOMEM	1	/* Out of memory. */
+#define EXIF_EFORMAT	2	/* Invalid or truncated data. */
+#define EXIF_ELIMIT	3	/* Stopped at a limit (partial result). */
+
+struct exifdiag {
+	int code;		/* Error code; EXIF_OK for a warning. */
+	const char *msg;	/* What's wrong. */
+	const char *arg;	/* What it applies to (e.g., a tag), or NULL. */
+	struct exifdiag *next;
+};
+
+
+/*
+ * Memory allocator for a parse context.  Everything the library
+ * allocates on a context's behalf (including the context) goes through
+ * alloc, which acts like malloc(), and release, which acts like free().
+ * Both are passed arg.  Running out (say, at a cap) just fails the parse
+ * with EXIF_ENOMEM.  See exifctxnewalloc().
+ */
+
+struct exifalloc {
+	void *(*alloc)(size_t len, void *arg);
+	void (*release)(void *p, void *arg);
+	void *arg;		/* Allocator's own state. */
+};
+
+
+/*
+ * Limits on what a single parse may take, so that a hostile file can't
+ * tie up a worker.  Zero means no limit.  A parse that hits one stops
+ * where it is and returns what it has so far, with EXIF_ELIMIT.  They
+ * hold until the parse returns; formatting its properties later (say,
+ * with propstr() after exifctxscan()) isn't counted against them.
+ */
+
+struct exiflimits {
+	u_int32_t ifds;		/* IFDs read (maker notes' included). */
+	u_int32_t props;	/* Properties. */
+	u_int32_t children;	/* Child properties of one property. */
+	size_t bytes;		/* Parse memory handed out. */
+	u_int32_t msecs;	/* Milliseconds elapsed. */
+};
+
+
+/*
+ * Parse context, for batch runs.  It holds on to the APP1 buffer and the
+ * parse memory from one Exif section to the next, so that they needn't
+ * be allocated over again for each file.  A parse's results, diags
+ * included, stay put until the context's next parse, which starts by
+ * giving back parse memory beyond keep bytes; a reset does the same,
+ * and also drops a buffer bigger than that.
+ *
+ * Everything a parse needs lives in its context or its struct exiftags,
+ * so separate threads can each parse with a context of their own.
+ *
+ * A parse leaves its error and diagnostics in the context.  (The calls
+ * that don't take one use a private context, reachable as t->ctx, which
+ * goes away with exiffree().  If they return NULL, there's nothing to
+ * look at.)
+ */
+
+#define EXIFCTXKEEP	131072	/* Default memory kept between parses. */
+
+struct exifctx {
+	unsigned char *buf;	/* APP1 buffer (see exifctxbuf()). */
+	size_t bufsz;		/* Size of buf. */
+	size_t keep;		/* Bytes to keep across resets. */
+	int debug;		/* Print parse debugging info. */
+	struct exiflimits limits; /* Per-parse limits (see above). */
+	struct exifalloc alloc;	/* Memory allocator (set at creation). */
+	void *mem;		/* Parse memory arena (internal only). */
+	void *propmem;		/* Arena for props alone (internal only). */
+	void *tblcache;		/* Table index cache (internal only). */
+	struct exifdiag *diags;	/* Diagnostics from the last parse. */
+	int error;		/* Error from the last parse, or EXIF_OK. */
+	size_t needoff;		/* Next bytes an incremental scan wants... */
+	size_t needlen;		/* ...and how many (0 if none). */
+	void *inc;		/* Incremental scan state (internal only). */
+	struct exiflimits used;	/* Use against limits (internal only). */
+	void *lastpar;		/* Parent last given a child (internal only). */
+	struct exiftags *cur;	/* Parse in progress (internal only). */
+	struct exifdiag *lastdiag; /* Tail of diags (internal only). */
+	struct exifdiag faildiag; /* Spare error record (internal only). */
+	void *fail;		/* Where failures go (internal only). */
+	int tmp;		/* Belongs to a single parse (internal only). */
 };
 
 
@@ -232,10 +354,21 @@ struct tiffmeta {
 
 struct exiftags {
 	struct exifprop *props;	/* The good stuff. */
+	struct exifprop *lastprop; /* Tail of props list (internal only). */
+	void *propmem;		/* Arena for props alone (internal only). */
+	void *propidx;		/* Index of props by tag (internal only). */
+	void *sel;		/* Selective scan state (internal only). */
+	void *visit;		/* Visitor state (internal only). */
+	u_int32_t nskip;	/* Fields passed over by exifscansel(). */
+	struct exifctx *ctx;	/* Context that owns our memory. */
+	void *tblcache;		/* Table index cache (internal only). */
+	void *ifdmd;		/* TIFF info of each IFD (internal only). */
+	int debug;		/* Print parse debugging info. */
 	struct tiffmeta md;	/* Beginning, end, and endianness of TIFF. */
 
 	const char *model;	/* Camera model, to aid maker tag processing. */
 	short mkrval;		/* Maker index (see makers.h). */
+	u_int32_t mkrflags;	/* Maker module state (internal only). */
 	struct tiffmeta mkrmd;	/* Maker TIFF info. */
 
 	/* Version info. */
@@ -247,18 +380,77 @@ struct exiftags {
 
 /* Eternal interfaces. */
 
-extern int debug;
 extern const char *progname;
 extern struct exiftag tags[];
 
-extern struct exifprop *findprop(struct exifprop *prop,
+extern struct exifprop *findprop(struct exiftags *t,
     struct exiftag *tagset, u_int16_t tag);
+extern char *propstr(struct exifprop *prop, struct exiftags *t);
+extern const char *propview(struct exifprop *prop, struct exiftags *t,
+    int *len);
+extern int propint(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    int32_t *v);
+extern int propuint(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    u_int32_t *v);
+extern u_int32_t propints(struct exifprop *prop, struct exiftags *t,
+    int32_t *v, u_int32_t n);
+extern u_int32_t propuints(struct exifprop *prop, struct exiftags *t,
+    u_int32_t *v, u_int32_t n);
+extern int proprtnl(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    u_int32_t *num, u_int32_t *den);
+extern int propsrtnl(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    int32_t *num, int32_t *den);
+extern int propdbl(struct exifprop *prop, struct exiftags *t, u_int32_t i,
+    double *v);
+extern int proptm(struct exifprop *prop, struct exiftags *t, struct tm *tm);
+extern int gpsdeg(struct exifprop *prop, struct exiftags *t, double *deg);
 extern void exifdie(const char *msg);
 extern void exifwarn(const char *msg);
 extern void exifwarn2(const char *msg1, const char *msg2);
+extern void exifwarndiags(struct exifdiag *diags);
 
 extern void exiffree(struct exiftags *t);
 extern struct exiftags *exifscan(unsigned char *buf, int len, int domkr);
+extern struct exiftags *exifscansel(unsigned char *buf, int len,
+    struct exifsel *sel);
 extern struct exiftags *exifparse(unsigned char *buf, int len);
+extern int exifvisit(unsigned char *buf, int len,
+    int (*fn)(struct exifprop *, struct exiftags *, void *), void *arg);
+
+extern struct exifctx *exifctxnew(void);
+extern struct exifctx *exifctxnewalloc(const struct exifalloc *alloc);
+extern void exifctxreset(struct exifctx *ctx);
+extern void exifctxfree(struct exifctx *ctx);
+extern unsigned char *exifctxbuf(struct exifctx *ctx, size_t len);
+extern struct exiftags *exifctxscan(struct exifctx *ctx, unsigned char *buf,
+    int len, int domkr);
+extern struct exiftags *exifctxscansel(struct exifctx *ctx,
+    unsigned char *buf, int len, struct exifsel *sel);
+extern struct exiftags *exifctxparse(struct exifctx *ctx, unsigned char *buf,
+    int len);
+extern int exifctxvisit(struct exifctx *ctx, unsigned char *buf, int len,
+    int (*fn)(struct exifprop *, struct exiftags *, void *), void *arg);
+
+/*
+ * An APP1 section that comes in a piece at a time can be fed to a
+ * context as it arrives, in any order: exifincbegin() with its length,
+ * then exifincadd() with each piece (at its offset in the section).
+ * Between pieces, needoff and needlen tell what the scan should get
+ * next.  Once exifincadd() returns false, everything the scan will look
+ * at is here, and exifincscan() or exifincparse() finish the job.
+ *
+ * Each time what the scan last asked for has all arrived, the section
+ * is scanned again from the top to see what the new bytes lead to, so
+ * a chain of n IFDs costs about 2n scans of what's here.  The number
+ * of those is capped, at a few per IFD if the context's limits.ifds is
+ * set; past that, exifincadd() stops asking with EXIF_ELIMIT, which the
+ * scan or parse then reports along with whatever it could find.
+ */
+
+extern int exifincbegin(struct exifctx *ctx, size_t len);
+extern int exifincadd(struct exifctx *ctx, size_t off,
+    const unsigned char *b, size_t n);
+extern struct exiftags *exifincscan(struct exifctx *ctx, int domkr);
+extern struct exiftags *exifincparse(struct exifctx *ctx);
 
 #endif
@@ -60,16 +60,25 @@ static const char *version = "1.01";
 static int fnum, bflag, iflag, nflag, vflag; 
 static const char *com;
 static const char *delim = ": ";
+static struct exifctx *ctx;
 
 #define ASCCOM		"ASCII\0\0\0"
 
+/* The only tag we need from exifscansel(). */
+
+static struct exifsel comsel[] = {
+	{ tags, EXIF_T_USERCOMMENT },
+	{ NULL, EXIF_T_UNKNOWN },
+};
+
 
 /*
  * Display the comment.  This function just uses what's returned by
- * exifscan() -- it doesn't touch the file.
+ * exifscansel() -- it doesn't touch the file.
  */
 static int
-printcom(const char *fname, struct exifprop *p, const unsigned char *btiff)
+printcom(const char *fname, struct exifprop *p, const char *s, int slen,
+    const unsigned char *btiff)
 {
 	int rc = 0;
 
@@ -104,21 +113,22 @@ printcom(const char *fname, struct exifprop *p, const unsigned char *btiff)
 
 	/* Comment tag OK, but blank. */
 
-	if (!rc && (!p->str || !*(p->str)))
+	if (!rc && !slen)
 		rc = 2;
 
 	/* Print comment in the normal, non-verbose case. */
 
 	if (!vflag) {
-		printf("%s", rc ? "" : p->str);
+		if (!rc)
+			fwrite(s, 1, slen, stdout);
 		return (rc);
 	}
 
 	/* Print length and comment if it's supported. */
 
 	if (rc != 1 && rc != 3) {
-		printf("Length%s%d\n", delim, rc ? 0 : (int)strlen(p->str));
-		printf("Comment%s%s\n", delim, rc ? "" : p->str);
+		printf("Length%s%d\n", delim, rc ? 0 : slen);
+		printf("Comment%s%.*s\n", delim, rc ? 0 : slen, rc ? "" : s);
 	}
 
 	return (rc);
@@ -129,7 +139,7 @@ printcom(const char *fname, struct exifprop *p, const unsigned char *btiff)
  * Blank or write a comment.
  */
 static int
-writecom(FILE *fp, const char *fname, long pos, struct exifprop *p,
+writecom(FILE *fp, const char *fname, long pos, struct exifprop *p, int slen,
     const unsigned char *buf, const unsigned char *btiff)
 {
 	u_int32_t l;
@@ -166,7 +176,7 @@ writecom(FILE *fp, const char *fname, long pos, struct exifprop *p,
 				return (1);
 			}
 
-		} else if (p->str && *(p->str)) {
+		} else if (slen) {
 			if (nflag)
 				return (1);
 			fprintf(stderr, "overwrite comment in %s? (y/n [n]) ",
@@ -255,10 +265,13 @@ writecom(FILE *fp, const char *fname, long pos, struct exifprop *p,
 static int
 doit(FILE *fp, const char *fname)
 {
-	int mark, gotapp1, first, rc;
+	int mark, gotapp1, first, rc, slen;
 	unsigned int len, rlen;
 	unsigned char *exifbuf;
+	const char *s;
 	struct exiftags *t;
+	struct jpegstate js;
+	struct exifprop *p;
 	long app1;
 
 	gotapp1 = FALSE;
@@ -266,47 +279,56 @@ doit(FILE *fp, const char *fname)
 	exifbuf = NULL;
 	rc = 0;
 
-	while (jpegscan(fp, &mark, &len, !(first++))) {
+	/* Start fresh, giving back anything the last file needed. */
 
-		if (mark != JPEG_M_APP1) {
-			if (fseek(fp, len, SEEK_CUR))
-				exifdie((const char *)strerror(errno));
+	exifctxreset(ctx);
+
+	while (jpegscan(fp, &mark, &len, !(first++), &js)) {
+		exifwarndiags(js.diags);
+
+		if (mark != JPEG_M_APP1)
 			continue;
-		}
 
-		exifbuf = (unsigned char *)malloc(len);
-		if (!exifbuf)
+		if (!(exifbuf = exifctxbuf(ctx, len)))
 			exifdie((const char *)strerror(errno));
 
-		app1 = ftell(fp);
-		rlen = fread(exifbuf, 1, len, fp);
+		app1 = jpegtell(&js);
+		rlen = jpegdata(exifbuf, len, &js);
 		if (rlen != len) {
 			fprintf(stderr, "%s: error reading JPEG (length "
 			    "mismatch)\n", fname);
-			free(exifbuf);
 			return (1);
 		}
 
 		gotapp1 = TRUE;
-		t = exifscan(exifbuf, len, FALSE);
-
-		if (t && t->props) {
+		t = exifctxscansel(ctx, exifbuf, len, comsel);
+		exifwarndiags(ctx->diags);
+
+		if (t && (t->props || t->nskip)) {
+			s = NULL;
+			slen = 0;
+			if ((p = findprop(t, tags, EXIF_T_USERCOMMENT)))
+				s = propview(p, t, &slen);
 			if (bflag || com)
-				rc = writecom(fp, fname, app1,
-				    findprop(t->props, tags,
-				    EXIF_T_USERCOMMENT), exifbuf, t->md.btiff);
+				rc = writecom(fp, fname, app1, p, slen,
+				    exifbuf, t->md.btiff);
 			else
-				rc = printcom(fname, findprop(t->props, tags,
-				    EXIF_T_USERCOMMENT), t->md.btiff);
+				rc = printcom(fname, p, s, slen,
+				    t->md.btiff);
 		} else {
 			fprintf(stderr, "%s: couldn't find Exif properties\n",
 			    fname);
 			rc = 1;
 		}
 		exiffree(t);
-		free(exifbuf);
 	}
 
+	/* We don't go on after a bad JPEG. */
+
+	exifwarndiags(js.diags);
+	if (js.error)
+		exit(1);
+
 	if (!gotapp1) {
 		fprintf(stderr, "%s: couldn't find Exif data\n", fname);
 		return (1);
@@ -347,7 +369,6 @@ main(int argc, char **argv)
 
 	progname = argv[0];
 	eval = 0;
-	debug = FALSE;
 	bflag = nflag = vflag = FALSE;
 	iflag = TRUE;
 	com = NULL;
@@ -392,6 +413,9 @@ main(int argc, char **argv)
 	if (!*argv)
 		usage();
 
+	if (!(ctx = exifctxnew()))
+		exifdie((const char *)strerror(errno));
+
 	for (fnum = 0; *argv; ++argv) {
 
 		/* Only open for read/write if we need to. */
@@ -428,5 +452,6 @@ main(int argc, char **argv)
 		fclose(fp);
 	}
 
+	exifctxfree(ctx);
 	return (eval);
 }
@@ -97,6 +97,10 @@ SOURCE=.\exifgps.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\exifinc.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\exifutil.c
 # End Source File
 # Begin Source File
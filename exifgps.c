@@ -184,7 +184,7 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 	/* Version. */
 
 	case 0x0000:
-		exifstralloc(&prop->str, 8);
+		exifstralloc(&prop->str, 8, t);
 
 		/* Convert the value back into a string. */
 
@@ -216,18 +216,16 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 	case 0x0019:
 		/* Clean-up from any earlier processing. */
 
-		free(prop->str);
 		prop->str = NULL;
+		prop->flags &= ~PR_CONSTSTR;
 
 		byte4exif(prop->value, (unsigned char *)buf, o);
 
-		for (i = 0; gpstags[i].tag < EXIF_T_UNKNOWN &&
-		    gpstags[i].tag != prop->tag; i++);
-		if (gpstags[i].table)
-			prop->str = finddescr(gpstags[i].table,
-			    (unsigned char)buf[0]);
+		if (prop->def->table)
+			descrprop(prop, prop->def->table,
+			    (unsigned char)buf[0], t);
 		else {
-			exifstralloc(&prop->str, 2);
+			exifstralloc(&prop->str, 2, t);
 			prop->str[0] = buf[0];
 		}
 		break;
@@ -246,29 +244,29 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 	case 0x0014:
 	case 0x0016:
 	 	if (prop->count != 3) {
-			exifwarn("unexpected GPS coordinate values");
+			exifnote("unexpected GPS coordinate values", NULL, t);
 			prop->lvl = ED_BAD;
 			break;
 		}
 
-		free(prop->str);
 		prop->str = NULL;
-		exifstralloc(&prop->str, 32);
+		prop->flags &= ~PR_CONSTSTR;
+		exifstralloc(&prop->str, 32, t);
 
 		/* Figure out the reference prefix. */
 
 		switch (prop->tag) {
 		case 0x0002:
-			tmpprop = findprop(t->props, gpstags, 0x0001);
+			tmpprop = findprop(t, gpstags, 0x0001);
 			break;
 		case 0x0004:
-			tmpprop = findprop(t->props, gpstags, 0x0003);
+			tmpprop = findprop(t, gpstags, 0x0003);
 			break;
 		case 0x0014:
-			tmpprop = findprop(t->props, gpstags, 0x0013);
+			tmpprop = findprop(t, gpstags, 0x0013);
 			break;
 		case 0x0016:
-			tmpprop = findprop(t->props, gpstags, 0x0015);
+			tmpprop = findprop(t, gpstags, 0x0015);
 			break;
 		default:
 			tmpprop = NULL;
@@ -318,8 +316,9 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 		d = exif4byte(t->md.btiff + prop->value + 4 + i * 8, o);
 
 		if (!n || !d) {			/* Assume no seconds. */
-			snprintf(prop->str, 31, fmt, tmpprop && tmpprop->str ?
-			    tmpprop->str : "", deg, DEGREE, min);
+			snprintf(prop->str, 31, fmt, tmpprop &&
+			    propstr(tmpprop, t) ? tmpprop->str : "", deg,
+			    DEGREE, min);
 			break;
 		} else {
 			sec = (double)n / (double)d;
@@ -329,8 +328,9 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 			} else
 				strcat(fmt, " %.f");
 		}
-		snprintf(prop->str, 31, fmt, tmpprop && tmpprop->str ?
-		    tmpprop->str : "", deg, DEGREE, min, sec);
+		snprintf(prop->str, 31, fmt, tmpprop &&
+		    propstr(tmpprop, t) ? tmpprop->str : "", deg, DEGREE,
+		    min, sec);
 		break;
 
 	/* Altitude. */
@@ -341,7 +341,7 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 
 		/* Look up reference.  Non-zero means negative altitude. */
 
-		tmpprop = findprop(t->props, gpstags, 0x0005);
+		tmpprop = findprop(t, gpstags, 0x0005);
 		if (tmpprop && tmpprop->value)
 			n *= -1;
 
@@ -380,3 +380,52 @@ gpsprop(struct exifprop *prop, struct exiftags *t)
 		break;
 	}
 }
+
+
+/*
+ * Return a GPS latitude or longitude (or destination latitude or
+ * longitude) in decimal degrees, negative to the south or west.  Like
+ * the display string, we take a zero numerator or denominator as zero.
+ */
+int
+gpsdeg(struct exifprop *prop, struct exiftags *t, double *deg)
+{
+	u_int32_t i, n, d;
+	unsigned char ref[4];
+	struct exifprop *refprop;
+	struct tiffmeta *md;
+
+	if (prop->tagset != gpstags || prop->count != 3)
+		return (FALSE);
+	switch (prop->tag) {
+	case 0x0002:
+	case 0x0004:
+	case 0x0014:
+	case 0x0016:
+		break;
+	default:
+		return (FALSE);
+	}
+
+	/* Degrees, minutes, and seconds. */
+
+	*deg = 0.0;
+	for (i = 0; i < 3; i++) {
+		if (!proprtnl(prop, t, i, &n, &d))
+			return (FALSE);
+		if (n && d)
+			*deg += (double)n / (double)d /
+			    (i == 0 ? 1.0 : (i == 1 ? 60.0 : 3600.0));
+	}
+
+	/* Each one's reference (e.g., "N" or "S") is the tag before it. */
+
+	refprop = findprop(t, gpstags, prop->tag - 1);
+	if (refprop && refprop->type == TIFF_ASCII && refprop->count &&
+	    refprop->count <= 4 && (md = propmd(refprop, t))) {
+		byte4exif(refprop->value, ref, md->order);
+		if (ref[0] == 'S' || ref[0] == 'W')
+			*deg = -*deg;
+	}
+	return (TRUE);
+}
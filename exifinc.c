@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2007, Eric M. Johnston <emj@postal.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Eric M. Johnston.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+/*
+ * Incremental scanning, for an Exif section that arrives a piece at a
+ * time (say, off a network).  Rather than wait for all of it, we scan
+ * what's here so far, with the scanner noting each range it would have
+ * read but couldn't (see exifincmiss()): the header, the IFDs, and the
+ * values they point to (maker notes included, whole).  Once those have
+ * all arrived, we scan again, which takes us as far as the new bytes
+ * lead; when a scan finds nothing missing, the section's ready.  Bytes
+ * nothing points to, such as a thumbnail image, aren't waited on.
+ *
+ * Each of those scans starts over from the header, so a chain of IFDs
+ * takes a couple of them per link.  That's cheap for a real section,
+ * but one crafted to link IFD after IFD could keep us at it, so the
+ * number of probes is capped (see incmax()).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "exif.h"
+#include "exifint.h"
+
+
+/*
+ * Free a context's incremental scan state.
+ */
+void
+incfree(struct exifctx *ctx)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+
+	if (!inc) return;
+	freemem(ctx, inc->got);
+	freemem(ctx, inc->want);
+	freemem(ctx, inc);
+	ctx->inc = NULL;
+}
+
+
+/*
+ * Make room for another range in a list of them.  Returns false if
+ * we're out of memory.
+ */
+static int
+incroom(struct exifctx *ctx, struct incrange **r, u_int32_t n,
+    u_int32_t *max)
+{
+	struct incrange *nr;
+
+	if (n < *max)
+		return (TRUE);
+	nr = (struct incrange *)allocmem(ctx, (*max ? *max * 2 :
+	    INCRANGES) * sizeof(struct incrange));
+	if (!nr)
+		return (FALSE);
+	if (n)
+		memcpy(nr, *r, n * sizeof(struct incrange));
+	freemem(ctx, *r);
+	*r = nr;
+	*max = *max ? *max * 2 : INCRANGES;
+	return (TRUE);
+}
+
+
+/*
+ * Check whether a range has arrived; if not, return the first of its
+ * bytes that hasn't and, in *end, the end of that gap (or of the range).
+ */
+static int
+inchave(struct incscan *inc, u_int32_t *start, u_int32_t *end)
+{
+	u_int32_t i;
+
+	for (i = 0; i < inc->ngot && inc->got[i].end <= *start; i++);
+	if (i < inc->ngot && inc->got[i].start <= *start) {
+		if (inc->got[i].end >= *end)
+			return (TRUE);
+		*start = inc->got[i++].end;
+	}
+	if (i < inc->ngot && inc->got[i].start < *end)
+		*end = inc->got[i].start;
+	return (FALSE);
+}
+
+
+/*
+ * Note that a range has arrived, merging it with its neighbors.  The
+ * list is kept in order.  Returns false if we're out of memory.
+ */
+static int
+incgot(struct exifctx *ctx, u_int32_t start, u_int32_t end)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	u_int32_t i, j;
+
+	for (i = 0; i < inc->ngot && inc->got[i].end < start; i++);
+	for (j = i; j < inc->ngot && inc->got[j].start <= end; j++) {
+		if (inc->got[j].start < start)
+			start = inc->got[j].start;
+		if (inc->got[j].end > end)
+			end = inc->got[j].end;
+	}
+
+	/* Ranges i through j - 1 become one. */
+
+	if (i == j) {
+		if (!incroom(ctx, &inc->got, inc->ngot, &inc->maxgot))
+			return (FALSE);
+		memmove(&inc->got[i + 1], &inc->got[i],
+		    (inc->ngot - i) * sizeof(struct incrange));
+		inc->ngot++;
+	} else if (j - i > 1) {
+		memmove(&inc->got[i + 1], &inc->got[j],
+		    (inc->ngot - j) * sizeof(struct incrange));
+		inc->ngot -= j - i - 1;
+	}
+	inc->got[i].start = start;
+	inc->got[i].end = end;
+	return (TRUE);
+}
+
+
+/*
+ * Called by the scanner before it reads len bytes at off from b: if
+ * we're scanning a section that hasn't all arrived, returns true when
+ * some of them are missing, so that it passes over whatever needs them.
+ * While probing, the range is also noted as wanted.  (Ranges outside
+ * the section are left to the scanner to complain about.)
+ */
+int
+exifincmiss(struct exifctx *ctx, const unsigned char *b, u_int32_t off,
+    u_int32_t len)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	u_int32_t start, end;
+
+	if (!inc || !inc->running || !len || b < ctx->buf ||
+	    b > ctx->buf + inc->len)
+		return (FALSE);
+	off += (u_int32_t)(b - ctx->buf);
+	if (off < (u_int32_t)(b - ctx->buf) || off > inc->len ||
+	    len > inc->len - off)
+		return (FALSE);
+	start = off;
+	end = off + len;
+	if (inchave(inc, &start, &end))
+		return (FALSE);
+
+	if (inc->probing) {
+		if (!incroom(ctx, &inc->want, inc->nwant, &inc->maxwant))
+			exiffail(ctx, EXIF_ENOMEM, "out of memory");
+		inc->want[inc->nwant].start = off;
+		inc->want[inc->nwant++].end = off + len;
+	}
+	return (TRUE);
+}
+
+
+/*
+ * Note the first bytes the scan still wants: the first gap in the
+ * earliest range it's waiting on.
+ */
+static void
+incneed(struct exifctx *ctx)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	u_int32_t i, start, end;
+
+	ctx->needoff = ctx->needlen = 0;
+	for (i = 0; i < inc->nwant; i++) {
+		start = inc->want[i].start;
+		end = inc->want[i].end;
+		if (inchave(inc, &start, &end))
+			continue;
+		if (!ctx->needlen || start < ctx->needoff) {
+			ctx->needoff = start;
+			ctx->needlen = end - start;
+		}
+	}
+}
+
+
+/*
+ * Grow the buffer to hold the section through end.  It only gets as
+ * big as the bytes that have come in (but at least as big as the Exif
+ * and TIFF headers, which the scanner looks at first).  Returns false
+ * if we're out of memory.
+ */
+static int
+incgrow(struct exifctx *ctx, u_int32_t end)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	unsigned char *buf;
+	size_t size;
+
+	if (end < INCHDRLEN)
+		end = INCHDRLEN;
+	if (end <= inc->top)
+		return (TRUE);
+
+	if (end > ctx->bufsz) {
+		size = ctx->bufsz * 2;
+		if (size < end)
+			size = end;
+		if (size > inc->len && inc->len >= end)
+			size = inc->len;
+		if (!(buf = (unsigned char *)allocmem(ctx, size)))
+			return (FALSE);
+		if (inc->top)
+			memcpy(buf, ctx->buf, inc->top);
+		freemem(ctx, ctx->buf);
+		ctx->buf = buf;
+		ctx->bufsz = size;
+	}
+	memset(ctx->buf + inc->top, 0, end - inc->top);
+	inc->top = end;
+	return (TRUE);
+}
+
+
+/*
+ * The most probes we'll run: a few per IFD if the context limits them,
+ * which is plenty for the header and each IFD's entries and values.
+ */
+static u_int32_t
+incmax(struct exifctx *ctx)
+{
+
+	if (ctx->limits.ifds && ctx->limits.ifds < INCPROBEMAX / INCPROBES)
+		return (ctx->limits.ifds * INCPROBES + 2);
+	return (INCPROBEMAX);
+}
+
+
+/*
+ * Note that we've stopped probing before the section was all here.
+ */
+static void
+inccapped(struct exifctx *ctx)
+{
+
+	exiffail(ctx, EXIF_ELIMIT, "incremental scan probed too many times");
+}
+
+
+/*
+ * Scan what we have, collecting the ranges that are wanted but missing.
+ * The scan's result and diagnostics are thrown away; it's run again
+ * once all of those ranges have arrived.  If none are wanted, or we've
+ * probed as much as we'll allow, we're done.  Returns false if we're
+ * out of memory.
+ */
+static int
+incprobe(struct exifctx *ctx)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	int debug;
+
+	if (inc->probes >= incmax(ctx)) {
+		inc->nwant = 0;
+		inc->done = inc->capped = TRUE;
+		inccapped(ctx);
+		return (TRUE);
+	}
+
+	debug = ctx->debug;
+	ctx->debug = FALSE;
+	inc->nwant = 0;
+	inc->probes++;
+	inc->running = inc->probing = TRUE;
+	(void)exifctxscan(ctx, ctx->buf, (int)inc->len, TRUE);
+	inc->running = inc->probing = FALSE;
+	ctx->debug = debug;
+
+	if (ctx->error == EXIF_ENOMEM)
+		return (FALSE);
+	ctx->diags = ctx->lastdiag = NULL;
+	ctx->faildiag.msg = NULL;
+	ctx->error = EXIF_OK;
+	if (!inc->nwant)
+		inc->done = TRUE;
+	return (TRUE);
+}
+
+
+/*
+ * Check whether everything the last probe wanted has arrived.
+ */
+static int
+incready(struct incscan *inc)
+{
+	u_int32_t i, start, end;
+
+	for (i = 0; i < inc->nwant; i++) {
+		start = inc->want[i].start;
+		end = inc->want[i].end;
+		if (!inchave(inc, &start, &end))
+			return (FALSE);
+	}
+	return (TRUE);
+}
+
+
+/*
+ * Get ready for a section of len bytes, dropping the context's last
+ * parse.  Returns EXIF_OK, or an error (also left in the context).
+ */
+int
+exifincbegin(struct exifctx *ctx, size_t len)
+{
+	struct incscan *inc;
+
+	exifmemtrim((struct exifmem *)ctx->mem, ctx->keep);
+	exifmemtrim((struct exifmem *)ctx->propmem, ctx->keep);
+	ctx->diags = ctx->lastdiag = NULL;
+	ctx->faildiag.msg = NULL;
+	ctx->error = EXIF_OK;
+	ctx->needoff = ctx->needlen = 0;
+	incfree(ctx);
+
+	/* The scan takes an int. */
+
+	if (len > INT_MAX) {
+		ctx->error = EXIF_EFORMAT;
+		return (ctx->error);
+	}
+
+	if (!(inc = (struct incscan *)allocmem(ctx, sizeof(struct incscan)))) {
+		ctx->error = EXIF_ENOMEM;
+		return (ctx->error);
+	}
+	memset(inc, 0, sizeof(struct incscan));
+	inc->len = (u_int32_t)len;
+	ctx->inc = (void *)inc;
+
+	/* Everything starts from the header. */
+
+	if (!incgrow(ctx, 0) || !incprobe(ctx)) {
+		incfree(ctx);
+		ctx->error = EXIF_ENOMEM;
+		return (ctx->error);
+	}
+	incneed(ctx);
+	return (EXIF_OK);
+}
+
+
+/*
+ * Add n bytes of the section, starting at off.  (Anything past the end
+ * is ignored.)  Returns true as long as the scan needs more; see needoff
+ * and needlen.  Returns false once it doesn't, or if there's been an
+ * error (left in the context).
+ */
+int
+exifincadd(struct exifctx *ctx, size_t off, const unsigned char *b,
+    size_t n)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+
+	if (!inc || inc->done)
+		return (FALSE);
+
+	if (off < inc->len && n) {
+		if (n > inc->len - off)
+			n = inc->len - off;
+		if (!incgrow(ctx, (u_int32_t)(off + n)) ||
+		    !incgot(ctx, (u_int32_t)off, (u_int32_t)(off + n)))
+			goto nomem;
+		memcpy(ctx->buf + off, b, n);
+	}
+
+	/* Once the last probe has all it wanted, see what's next. */
+
+	if (incready(inc) && !incprobe(ctx))
+		goto nomem;
+	incneed(ctx);
+	return (!inc->done);
+
+nomem:
+	incfree(ctx);
+	ctx->needoff = ctx->needlen = 0;
+	ctx->error = EXIF_ENOMEM;
+	return (FALSE);
+}
+
+
+/*
+ * Scan or parse the section (see exifctxscan() and exifctxparse()).
+ * This can be done before it's all here, in which case whatever needs
+ * data that hasn't arrived is skipped.
+ */
+struct exiftags *
+exifincscan(struct exifctx *ctx, int domkr)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	struct exiftags *t;
+
+	if (!inc)
+		return (NULL);
+	inc->running = TRUE;
+	t = exifctxscan(ctx, ctx->buf, (int)inc->len, domkr);
+	inc->running = FALSE;
+	if (t && inc->capped)
+		inccapped(ctx);
+	return (t);
+}
+
+struct exiftags *
+exifincparse(struct exifctx *ctx)
+{
+	struct incscan *inc = (struct incscan *)ctx->inc;
+	struct exiftags *t;
+
+	if (!inc)
+		return (NULL);
+	inc->running = TRUE;
+	t = exifctxparse(ctx, ctx->buf, (int)inc->len);
+	inc->running = FALSE;
+	if (t && inc->capped)
+		inccapped(ctx);
+	return (t);
+}
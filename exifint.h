@@ -76,6 +76,37 @@ struct field {
 };
 
 
+/*
+ * An IFD's entries, decoded into parallel arrays.  As in struct exifprop,
+ * a lone short's value is just the short.  Each entry's type is also
+ * looked up: ftype is its position in ftypes[], or -1 if it's unknown.
+ */
+
+struct fieldvals {
+	u_int16_t *tags;
+	u_int16_t *types;
+	u_int32_t *counts;
+	u_int32_t *values;
+	signed char *ftype;
+};
+
+
+/*
+ * Loads of 2- and 4-byte ints in a given byte order.  Code that knows
+ * its order ahead of time (e.g., for a whole IFD) can use these rather
+ * than exif2byte() and friends, which check on every call.
+ */
+
+#define EXIF2BE(b)	((u_int16_t)(((b)[0] << 8) | (b)[1]))
+#define EXIF2LE(b)	((u_int16_t)(((b)[1] << 8) | (b)[0]))
+#define EXIF4BE(b)	(((u_int32_t)(b)[0] << 24) | \
+			    ((u_int32_t)(b)[1] << 16) | \
+			    ((u_int32_t)(b)[2] << 8) | (u_int32_t)(b)[3])
+#define EXIF4LE(b)	(((u_int32_t)(b)[3] << 24) | \
+			    ((u_int32_t)(b)[2] << 16) | \
+			    ((u_int32_t)(b)[1] << 8) | (u_int32_t)(b)[0])
+
+
 /* IFD entry. */
 
 struct ifd {
@@ -96,6 +127,211 @@ struct ifdoff {
 };
 
 
+/*
+ * Parse memory arena.  Everything allocated while parsing an Exif section
+ * (properties, display strings, IFD bookkeeping) is carved out of a
+ * handful of large blocks, which are released together by exiffree().
+ * If the arena can't grow, exifmemalloc() fails the parse through its
+ * context (see exiffail()); exifmemtry() just returns NULL.
+ */
+
+#define MEMBLKSZ	8192	/* Default arena block size. */
+
+union memalign {
+	long l;
+	double d;
+	void *p;
+};
+
+struct memblk {
+	struct memblk *next;	/* Next block in arena. */
+	size_t size;		/* Usable bytes in block. */
+	size_t used;		/* Bytes handed out so far. */
+};
+
+struct exifmem {
+	struct memblk *first;	/* All blocks, in order of creation. */
+	struct memblk *cur;	/* Block we're currently carving. */
+	struct exifctx *ctx;	/* Context to fail, if we can't grow. */
+};
+
+
+/* Selective scan state (see exifscansel()). */
+
+struct selscan {
+	struct exifsel *sel;	/* Tags wanted. */
+	unsigned char *found;	/* Which of them have turned up. */
+	int left;		/* Number still to find. */
+};
+
+
+/*
+ * Visitor state (see exifvisit()).  Standard properties that a maker
+ * note might yet override are held back until the end of the scan.
+ * Those that have been visited and aren't needed later are kept for
+ * newprop() to reuse.
+ */
+
+struct visitscan {
+	int (*fn)(struct exifprop *, struct exiftags *, void *);
+	void *arg;		/* Visitor's argument. */
+	struct exifprop **held;	/* Properties held back. */
+	u_int32_t nheld;	/* Number held. */
+	u_int32_t maxheld;	/* Room in held. */
+	struct exifprop *spare;	/* Visited properties, free for reuse. */
+	int stop;		/* Visitor asked us to stop. */
+};
+
+
+/*
+ * Incremental scan state (see exifincadd()).  We keep track of the byte
+ * ranges that have arrived, in order, and of the ones the last probe of
+ * the section wanted.
+ */
+
+#define INCHDRLEN	14	/* Exif and TIFF headers. */
+#define INCRANGES	16	/* Initial room for ranges. */
+#define INCPROBES	3	/* Most probes per IFD allowed... */
+#define INCPROBEMAX	64	/* ...or in all, without an IFD limit. */
+
+struct incrange {
+	u_int32_t start;	/* First byte. */
+	u_int32_t end;		/* One past the last. */
+};
+
+struct incscan {
+	u_int32_t len;		/* Length of section. */
+	u_int32_t top;		/* Bytes of buffer in use. */
+	struct incrange *got;	/* Ranges that have arrived. */
+	u_int32_t ngot;		/* Number of them. */
+	u_int32_t maxgot;	/* Room in got. */
+	struct incrange *want;	/* Ranges the last probe wanted. */
+	u_int32_t nwant;	/* Number of them. */
+	u_int32_t maxwant;	/* Room in want. */
+	u_int32_t probes;	/* Scans run to see what's missing. */
+	int running;		/* Scanning the section. */
+	int probing;		/* ...just to see what's missing. */
+	int done;		/* Nothing more is wanted. */
+	int capped;		/* ...or we've stopped asking. */
+};
+
+
+/*
+ * Tag definition index, built the first time a struct exiftag table is
+ * searched and shared by all contexts.  Slots hold the entry's position
+ * in the table plus one, so that zero marks an empty slot.
+ */
+
+#define TAGIDXMIN	16	/* Minimum slots per table index. */
+#define TAGIDXPOOL	64	/* Tag definition indexes per process. */
+#define TAGSLOTPOOL	8192	/* Slots for all of them. */
+
+struct tagidx {
+	struct exiftag *table;	/* Table we index. */
+	u_int16_t *slots;	/* Hash of tag -> position + 1. */
+	u_int32_t size;		/* Number of slots (power of 2). */
+	u_int16_t unkn;		/* Position of the terminating entry. */
+};
+
+
+/*
+ * Value description index, built the first time a struct descrip table
+ * is searched and likewise shared.  Slots are indexed by value less the
+ * table's lowest, and hold the entry's position plus one.  Tables whose
+ * values span more than DESCIDXMAX are short enough to just scan.
+ */
+
+#define DESCIDXMAX	256
+#define DESCIDXPOOL	512	/* Description indexes per process. */
+#define DESCSLOTPOOL	8192	/* Slots for all of them. */
+
+struct descidx {
+	u_int16_t *slots;	/* Value - base -> position + 1. */
+	int32_t base;		/* Lowest value in the table. */
+	u_int32_t span;		/* Number of slots; 0 if not indexed. */
+	u_int16_t unkn;		/* Position of the terminating entry. */
+};
+
+
+/*
+ * Registry of the above indexes, keyed on table address, kept for the
+ * process.  Each context has a small direct-mapped cache in front of
+ * it, allocated along with the context, so that it needn't take the
+ * registry's lock for tables it has already used.
+ */
+
+#define TBLREGMAX	2048	/* Slots in the registry. */
+#define TBLCACHESZ	64	/* Slots in a context's cache. */
+
+struct tblreg {
+	const void *table;	/* Table indexed. */
+	void *idx;		/* struct tagidx or struct descidx. */
+};
+
+struct tblcache {
+	struct tblreg regs[TBLCACHESZ];
+};
+
+
+/*
+ * TIFF metadata for each IFD read, by IFD sequence number; a property
+ * finds its own through its ifdseq (see propmd()).
+ */
+
+struct ifdmeta {
+	struct tiffmeta **md;	/* Metadata, by sequence number. */
+	int num;		/* Number of IFDs read. */
+	int max;		/* Size of md. */
+};
+
+
+/* Property flags. */
+
+#define PR_CONSTSTR	0x0001	/* str belongs to a table; don't modify. */
+#define PR_SANESTR	0x0002	/* Clean up str when it's formatted. */
+#define PR_IFDPAR	0x0004	/* Parent of an IFD. */
+
+
+/*
+ * Property index, mapping (tagset, tag) to props.  Open addressing with
+ * linear probing, so props sharing a key sit in the order they were
+ * hashed.  Props added after the index is built are queued until the
+ * next lookup, noting whether they went in ahead of the list's end.
+ */
+
+#define PROPIDXMIN	64	/* Minimum number of index slots. */
+
+struct idxpend {
+	struct exifprop *prop;	/* Prop added. */
+	int amb;		/* Inserted mid-list (see propindex()). */
+};
+
+struct propidx {
+	struct exifprop **slots; /* Hash table of props. */
+	unsigned char *amb;	/* Key's props may be out of list order. */
+	u_int32_t size;		/* Number of slots (power of 2). */
+	u_int32_t used;		/* Number of slots filled. */
+	struct idxpend *pend;	/* Props added since last lookup. */
+	u_int32_t npend;	/* Number of queued props. */
+	u_int32_t maxpend;	/* Size of queue. */
+};
+
+
+/*
+ * Display string formats that parsetag() leaves pending in exifprop's
+ * fmt, to be built by propstr() on first use.
+ */
+
+#define PF_NONE		0
+#define PF_DESCR	1	/* Description from tag's value table. */
+#define PF_VERSION	2	/* Exif version. */
+#define PF_COMMENT	3	/* ASCII user comment. */
+#define PF_FILESRC	4	/* File source. */
+#define PF_ASCII	5	/* ASCII string. */
+#define PF_RTNL		6	/* Rational (signed or not). */
+#define PF_SHORTS	7	/* List of (up to 8) shorts. */
+
+
 /* Macro for making sense of a fraction. */
 
 #define fixfract(str, n, d, t)	{ \
@@ -127,19 +363,45 @@ extern struct descrip filesrcs[];
 
 /* Utility functions from exifutil.c. */
 
+extern void exifnote(const char *msg, const char *arg, struct exiftags *t);
+extern void exiffail(struct exifctx *ctx, int code, const char *msg);
+extern void exiflimit(struct exifctx *ctx, const char *msg);
+extern u_int32_t exifmsecs(void);
+extern void exiftimeout(struct exifctx *ctx);
 extern int offsanity(struct exifprop *prop, u_int16_t size, struct ifd *dir);
 extern u_int16_t exif2byte(unsigned char *b, enum byteorder o);
 extern int16_t exif2sbyte(unsigned char *b, enum byteorder o);
 extern u_int32_t exif4byte(unsigned char *b, enum byteorder o);
 extern void byte4exif(u_int32_t n, unsigned char *b, enum byteorder o);
 extern int32_t exif4sbyte(unsigned char *b, enum byteorder o);
-extern char *finddescr(struct descrip *table, u_int16_t val);
-extern int catdescr(char *c, struct descrip *table, u_int16_t val, int len);
-extern struct exifprop *newprop(void);
-extern struct exifprop *childprop(struct exifprop *parent);
-extern void exifstralloc(char **str, int len);
+extern void *allocmem(struct exifctx *ctx, size_t len);
+extern void freemem(struct exifctx *ctx, void *p);
+extern struct exiftag *findtag(struct exiftag *table, u_int16_t tag,
+    struct exiftags *t);
+extern const char *finddescr(struct descrip *table, u_int16_t val,
+    struct exiftags *t);
+extern void descrprop(struct exifprop *prop, struct descrip *table,
+    u_int16_t val, struct exiftags *t);
+extern int catdescr(char *c, struct descrip *table, u_int16_t val, int len,
+    struct exiftags *t);
+extern struct exifmem *exifmemnew(struct exifctx *ctx);
+extern void *exifmemalloc(struct exifmem *mem, size_t len);
+extern void *exifmemtry(struct exifmem *mem, size_t len);
+extern void exifmemtrim(struct exifmem *mem, size_t keep);
+extern void exifmemfree(struct exifmem *mem);
+extern struct exifprop *findnextprop(struct exifprop *prop,
+    struct exiftag *tagset, u_int16_t tag);
+extern void propindex(struct exifprop *prop, struct exiftags *t, int amb);
+extern void propreindex(struct exiftags *t);
+extern struct exifprop *newprop(struct exiftags *t);
+extern struct tiffmeta *propmd(struct exifprop *prop,
+    struct exiftags *t);
+extern struct exifprop *childprop(struct exifprop *parent,
+    struct exiftags *t);
+extern void exifstralloc(char **str, int len, struct exiftags *t);
 extern void hexprint(unsigned char *b, int len);
-extern void dumpprop(struct exifprop *prop, struct field *afield);
+extern void dumpprop(struct exifprop *prop, struct field *afield,
+    struct exiftags *t);
 extern struct ifd *readifds(u_int32_t offset, struct exiftag *tagset,
     struct tiffmeta *md);
 extern u_int32_t readifd(u_int32_t offset, struct ifd **dir,
@@ -151,4 +413,10 @@ extern u_int32_t gcd(u_int32_t a, u_int32_t b);
 extern struct exiftag gpstags[];
 extern void gpsprop(struct exifprop *prop, struct exiftags *t);
 
+/* Interface to exifinc.c. */
+
+extern int exifincmiss(struct exifctx *ctx, const unsigned char *b,
+    u_int32_t off, u_int32_t len);
+extern void incfree(struct exifctx *ctx);
+
 #endif
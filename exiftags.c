@@ -58,15 +58,44 @@ int getopt(int, char * const [], const char *);
 
 int quiet;
 static const char *version = "1.01";
-static int fnum;
+static int fnum, debug;
 static const char *delim = ": ";
+static struct exifctx *ctx;
 
+/* For reading just the start of each file (-r). */
 
+static struct {
+	size_t len;		/* Bytes to read at first. */
+	unsigned char *buf;	/* What we've read of the file. */
+	size_t size;		/* Size of buf. */
+	int files;		/* Files read this way... */
+	int rereads;		/* ...and how many had to be read again. */
+} rd;
+
+
+/*
+ * Exit, cleaning up, and, with -r, saying how it did.
+ */
 static void
-printprops(struct exifprop *list, unsigned short lvl, int pas)
+quit(int eval)
+{
+
+	if (rd.len)
+		fprintf(stderr, "%s: %d of %d files needed more than one "
+		    "read\n", progname, rd.rereads, rd.files);
+
+	free(rd.buf);
+	exifctxfree(ctx);
+	exit(eval);
+}
+
+
+static void
+printprops(struct exifprop *list, struct exiftags *t, unsigned short lvl,
+    int pas)
 {
 	static int prevf = -1;
-	const char *n;
+	const char *n, *s;
 
 	if (!quiet) {
 		if (prevf == fnum)
@@ -107,8 +136,8 @@ printprops(struct exifprop *list, unsigned short lvl, int pas)
 
 		if (list->lvl == lvl) {
 			n = list->descr ? list->descr : list->name;
-			if (list->str)
-				printf("%s%s%s\n", n, delim, list->str);
+			if ((s = propstr(list, t)))
+				printf("%s%s%s\n", n, delim, s);
 			else
 				printf("%s%s%d\n", n, delim, list->value);
 		}
@@ -118,57 +147,199 @@ printprops(struct exifprop *list, unsigned short lvl, int pas)
 }
 
 
+/*
+ * Parse and print an APP1 section.  Returns true if it had Exif data.
+ */
+static int
+showexif(unsigned char *b, unsigned int len, int dumplvl, int pas)
+{
+	int gotexif = FALSE;
+	struct exiftags *t;
+
+	t = exifctxparse(ctx, b, len);
+	exifwarndiags(ctx->diags);
+
+	if (t && t->props) {
+		gotexif = TRUE;
+
+		if (dumplvl & ED_CAM)
+			printprops(t->props, t, ED_CAM, pas);
+		if (dumplvl & ED_IMG)
+			printprops(t->props, t, ED_IMG, pas);
+		if (dumplvl & ED_VRB)
+			printprops(t->props, t, ED_VRB, pas);
+		if (dumplvl & ED_UNK)
+			printprops(t->props, t, ED_UNK, pas);
+		if (dumplvl & ED_BAD)
+			printprops(t->props, t, ED_BAD, pas);
+	}
+	exiffree(t);
+	return (gotexif);
+}
+
+
+/*
+ * Make sure we've read the first want bytes of the file, given that we
+ * have the first have.  Returns how many we have now.
+ */
+static size_t
+readto(FILE *fp, size_t have, size_t want)
+{
+	unsigned char *b;
+
+	if (want > rd.size) {
+		if (!(b = (unsigned char *)realloc(rd.buf, want)))
+			exifdie((const char *)strerror(errno));
+		rd.buf = b;
+		rd.size = want;
+	}
+	return (have + jpegread(fp, rd.buf + have, have, want - have));
+}
+
+
+/*
+ * Look for Exif data in the first rd.len bytes of the file, read in one
+ * go, only reading more if a marker runs past them.  We stop at the
+ * first Exif section.
+ */
+static int
+doread(FILE *fp, int dumplvl, int pas)
+{
+	int mark, first, rval, bad;
+	unsigned int len;
+	size_t have, want, off;
+	struct jpegstate js;
+
+	first = TRUE;
+	bad = FALSE;
+	rval = -1;
+	want = rd.len;
+	have = readto(fp, 0, want);
+
+	while (rval == -1) {
+		if (!jpegscanmem(rd.buf, have, &mark, &off, &len, first,
+		    &js)) {
+
+			/* If we just ran out of what we've read, get more. */
+
+			if (js.need && have == want) {
+				want = js.need + rd.len;
+				have = readto(fp, have, want);
+				continue;
+			}
+
+			/* We don't go on after a bad JPEG. */
+
+			exifwarndiags(js.diags);
+			if (js.error)
+				bad = TRUE;
+			else
+				exifwarn("couldn't find Exif data");
+			rval = 1;
+			break;
+		}
+		first = FALSE;
+		exifwarndiags(js.diags);
+
+		if (mark != JPEG_M_APP1)
+			continue;
+
+		if (have - off < len && have == want) {
+			want = off + len + rd.len;
+			have = readto(fp, have, want);
+		}
+		if (have - off < len) {
+			exifwarn("error reading JPEG (length mismatch)");
+			rval = 1;
+		} else if (showexif(rd.buf + off, len, dumplvl, pas))
+			rval = 0;
+	}
+
+	/* We've only grown past rd.len if we had to read again. */
+
+	rd.files++;
+	if (want > rd.len)
+		rd.rereads++;
+	if (bad)
+		quit(1);
+	return (rval);
+}
+
+
 static int
 doit(FILE *fp, int dumplvl, int pas)
 {
 	int mark, gotexif, first;
 	unsigned int len, rlen;
 	unsigned char *exifbuf;
-	struct exiftags *t;
+	const unsigned char *map;
+	size_t maplen, off;
+	struct jpegstate js;
 
 	gotexif = FALSE;
 	first = 0;
 	exifbuf = NULL;
 
-	while (jpegscan(fp, &mark, &len, !(first++))) {
+	/* Start fresh, giving back anything the last file needed. */
 
-		if (mark != JPEG_M_APP1) {
-			if (fseek(fp, len, SEEK_CUR))
-				exifdie((const char *)strerror(errno));
-			continue;
-		}
+	exifctxreset(ctx);
 
-		exifbuf = (unsigned char *)malloc(len);
-		if (!exifbuf)
-			exifdie((const char *)strerror(errno));
+	if (rd.len)
+		return (doread(fp, dumplvl, pas));
 
-		rlen = fread(exifbuf, 1, len, fp);
-		if (rlen != len) {
-			exifwarn("error reading JPEG (length mismatch)");
-			free(exifbuf);
-			return (1);
+	/*
+	 * If we can, look at the file in place.  (We only read; the
+	 * parse can use the mapping as its buffer.)
+	 */
+
+	if ((map = jpegmap(fp, &maplen))) {
+		while (jpegscanmem(map, maplen, &mark, &off, &len,
+		    !(first++), &js)) {
+			exifwarndiags(js.diags);
+
+			if (mark != JPEG_M_APP1)
+				continue;
+
+			if (maplen - off < len) {
+				exifwarn("error reading JPEG "
+				    "(length mismatch)");
+				jpegunmap(map, maplen);
+				return (1);
+			}
+
+			if (showexif((unsigned char *)(map + off), len,
+			    dumplvl, pas))
+				gotexif = TRUE;
 		}
+		jpegunmap(map, maplen);
+	} else {
+		while (jpegscan(fp, &mark, &len, !(first++), &js)) {
+			exifwarndiags(js.diags);
+
+			if (mark != JPEG_M_APP1)
+				continue;
 
-		t = exifparse(exifbuf, len);
-
-		if (t && t->props) {
-			gotexif = TRUE;
-
-			if (dumplvl & ED_CAM)
-				printprops(t->props, ED_CAM, pas);
-			if (dumplvl & ED_IMG)
-				printprops(t->props, ED_IMG, pas);
-			if (dumplvl & ED_VRB)
-				printprops(t->props, ED_VRB, pas);
-			if (dumplvl & ED_UNK)
-				printprops(t->props, ED_UNK, pas);
-			if (dumplvl & ED_BAD)
-				printprops(t->props, ED_BAD, pas);
+			if (!(exifbuf = exifctxbuf(ctx, len)))
+				exifdie((const char *)strerror(errno));
+
+			rlen = jpegdata(exifbuf, len, &js);
+			if (rlen != len) {
+				exifwarn("error reading JPEG "
+				    "(length mismatch)");
+				return (1);
+			}
+
+			if (showexif(exifbuf, len, dumplvl, pas))
+				gotexif = TRUE;
 		}
-		exiffree(t);
-		free(exifbuf);
 	}
 
+	/* We don't go on after a bad JPEG. */
+
+	exifwarndiags(js.diags);
+	if (js.error)
+		quit(1);
+
 	if (!gotexif) {
 		exifwarn("couldn't find Exif data");
 		return (1);
@@ -195,6 +366,9 @@ void usage()
 	fprintf(stderr, "  -l\tCamera has a removable lens.\n");
 	fprintf(stderr, "  -d\tDisplay parse debug information.\n");
 	fprintf(stderr, "  -q\tSuppress section headers.\n");
+	fprintf(stderr, "  -r\tRead the provided number of bytes from the "
+	    "start of each\n\tfile at once, stopping at the first Exif "
+	    "section.\n");
 	fprintf(stderr, "  -s\tSet delimiter to provided string "
 	    "(default: \": \").\n");
 
@@ -207,7 +381,7 @@ main(int argc, char **argv)
 {
 	register int ch;
 	int dumplvl, pas, eval;
-	char *mode;
+	char *mode, *end;
 	FILE *fp;
 
 	progname = argv[0];
@@ -220,7 +394,7 @@ main(int argc, char **argv)
 	mode = "r";
 #endif
 
-	while ((ch = getopt(argc, argv, "acivuldqs:")) != -1)
+	while ((ch = getopt(argc, argv, "acivuldqr:s:")) != -1)
 		switch (ch) {
 		case 'a':
 			dumplvl |= (ED_CAM | ED_IMG | ED_VRB);
@@ -246,6 +420,11 @@ main(int argc, char **argv)
 		case 'q':
 			quiet = TRUE;
 			break;
+		case 'r':
+			rd.len = strtoul(optarg, &end, 10);
+			if (*end || !rd.len)
+				usage();
+			break;
 		case 's':
 			delim = optarg;
 			break;
@@ -262,6 +441,10 @@ main(int argc, char **argv)
 	if (debug && (dumplvl & ED_UNK))
 		dumplvl |= ED_BAD;
 
+	if (!(ctx = exifctxnew()))
+		exifdie((const char *)strerror(errno));
+	ctx->debug = debug;
+
 	if (*argv) {
 		for (fnum = 0; *argv; ++argv) {
 			if ((fp = fopen(*argv, mode)) == NULL) {
@@ -286,5 +469,6 @@ main(int argc, char **argv)
 			eval = 1;
 	}
 
-	exit(eval);
+	quit(eval);
+	return (eval);
 }
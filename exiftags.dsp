@@ -105,6 +105,10 @@ SOURCE=.\exifgps.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\exifinc.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\exiftags.c
 # End Source File
 # Begin Source File
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2007, Eric M. Johnston <emj@postal.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *      This product includes software developed by Eric M. Johnston.
+ * 4. Neither the name of the author nor the names of any co-contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $Id$
+ */
+
+/*
+ * exiftest: check library behavior that the programs don't exercise.
+ * Exits non-zero (and says why) if a check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exif.h"
+
+
+/*
+ * A little-endian Exif section with just Make and Model in IFD0.
+ */
+static unsigned char minexif[] = {
+	'E', 'x', 'i', 'f', 0, 0,
+	'I', 'I', 42, 0, 8, 0, 0, 0,			/* TIFF header. */
+	2, 0,						/* IFD0. */
+	0x0f, 0x01, 2, 0, 10, 0, 0, 0, 38, 0, 0, 0,
+	0x10, 0x01, 2, 0, 12, 0, 0, 0, 48, 0, 0, 0,
+	0, 0, 0, 0,
+	'T', 'e', 's', 't', 'M', 'a', 'k', 'e', 'r', 0,
+	'T', 'e', 's', 't', ' ', 'M', 'o', 'd', 'e', 'l', 0, 0,
+};
+
+/*
+ * One with an Exif IFD off of IFD0 and an IFD1 after it, so that an
+ * incremental scan has to follow a few links.
+ */
+static unsigned char nestexif[] = {
+	'E', 'x', 'i', 'f', 0, 0,
+	'I', 'I', 42, 0, 8, 0, 0, 0,			/* TIFF header. */
+	2, 0,						/* IFD0. */
+	0x0f, 0x01, 2, 0, 10, 0, 0, 0, 38, 0, 0, 0,
+	0x69, 0x87, 4, 0, 1, 0, 0, 0, 48, 0, 0, 0,
+	86, 0, 0, 0,
+	'T', 'e', 's', 't', 'M', 'a', 'k', 'e', 'r', 0,
+	1, 0,						/* Exif IFD. */
+	0x03, 0x90, 2, 0, 20, 0, 0, 0, 66, 0, 0, 0,
+	0, 0, 0, 0,
+	'2', '0', '0', '4', ':', '0', '5', ':', '0', '6', ' ',
+	'0', '7', ':', '0', '8', ':', '0', '9', 0,
+	1, 0,						/* IFD1. */
+	0x31, 0x01, 2, 0, 4, 0, 0, 0, 'a', 'b', 'c', 0,
+	0, 0, 0, 0,
+};
+
+#define CHAINIFDS	48	/* IFDs in the probe cap's chain. */
+
+static int failed;
+
+
+static void
+check(int ok, const char *what)
+{
+
+	if (!ok) {
+		fprintf(stderr, "%s: %s\n", progname, what);
+		failed = 1;
+	}
+}
+
+
+/*
+ * The same, for a check on the named section.
+ */
+static void
+checksect(int ok, const char *sect, const char *what)
+{
+
+	if (!ok) {
+		fprintf(stderr, "%s: %s: %s\n", progname, sect, what);
+		failed = 1;
+	}
+}
+
+
+/*
+ * A property formatted after a scan mustn't be held to the scan's
+ * memory limit, or fail a scan that's already succeeded.
+ */
+static void
+proplimit(void)
+{
+	struct exifctx *ctx;
+	struct exiftags *t;
+	struct exifprop *p;
+	char *s;
+
+	if (!(ctx = exifctxnew()))
+		exifdie("can't allocate context");
+
+	/* Find what the scan takes, then allow exactly that. */
+
+	t = exifctxscan(ctx, minexif, sizeof(minexif), FALSE);
+	check(t != NULL, "scan failed");
+	ctx->limits.bytes = ctx->used.bytes;
+
+	t = exifctxscan(ctx, minexif, sizeof(minexif), FALSE);
+	check(t != NULL && ctx->error == EXIF_OK, "limited scan failed");
+	if (!t) {
+		exifctxfree(ctx);
+		return;
+	}
+
+	for (p = t->props; p && p->tag != EXIF_T_MODEL; p = p->next);
+	check(p != NULL && !p->str, "no unformatted model property");
+	if (p) {
+		s = propstr(p, t);
+		check(s && !strcmp(s, "Test Model"),
+		    "propstr() after scan failed");
+		check(ctx->error == EXIF_OK, "propstr() after scan set error");
+	}
+	exifctxfree(ctx);
+}
+
+
+/*
+ * Build an Exif section in b holding one ASCII field (of more than four
+ * bytes) in IFD0.  Returns its length.
+ */
+static int
+asciiexif(unsigned char *b, u_int16_t tag, const char *s)
+{
+	static const unsigned char hdr[] = {
+		'E', 'x', 'i', 'f', 0, 0,
+		'I', 'I', 42, 0, 8, 0, 0, 0,
+		1, 0,
+	};
+	u_int32_t n;
+
+	n = (u_int32_t)strlen(s) + 1;
+	memset(b, 0, 32);
+	memcpy(b, hdr, sizeof(hdr));
+	b[16] = tag & 0xff;
+	b[17] = tag >> 8;
+	b[18] = 2;					/* ASCII. */
+	b[20] = n & 0xff;
+	b[21] = n >> 8;
+	b[24] = 26;					/* Value offset. */
+	memcpy(b + 32, s, n);
+	return (32 + (int)n);
+}
+
+
+/*
+ * Check that proptm() reads a DateTime as sscanf() did.
+ */
+static void
+tmcheck(const char *s, int ok, int year, int sec)
+{
+	unsigned char b[64];
+	struct exifctx *ctx;
+	struct exiftags *t;
+	struct exifprop *p;
+	struct tm tm;
+	char what[64];
+
+	if (!(ctx = exifctxnew()))
+		exifdie("can't allocate context");
+
+	snprintf(what, sizeof(what), "proptm() on \"%s\"", s);
+	t = exifctxscan(ctx, b, asciiexif(b, EXIF_T_DATETIME, s), FALSE);
+	for (p = t ? t->props : NULL; p && p->tag != EXIF_T_DATETIME;
+	    p = p->next);
+	check(p != NULL, "no DateTime property");
+	if (p) {
+		if (proptm(p, t, &tm) != ok)
+			check(FALSE, what);
+		else if (ok)
+			check(tm.tm_year == year - 1900 && tm.tm_mon == 4 &&
+			    tm.tm_mday == 6 && tm.tm_hour == 7 &&
+			    tm.tm_min == 8 && tm.tm_sec == sec, what);
+	}
+	exifctxfree(ctx);
+}
+
+
+/*
+ * A Make short enough to sit in its field ("HP") is still read through
+ * its value as an offset, to look up the maker.  Fed in pieces, a scan
+ * has to wait for the bytes there, not read past what's arrived.
+ */
+static void
+incinline(void)
+{
+	unsigned char *b;
+	struct exifctx *ctx;
+	u_int32_t off;
+	size_t len;
+	int more;
+
+	off = 6 + ('H' | 'P' << 8);
+	len = off + 3;
+	if (!(b = (unsigned char *)calloc(1, len)) || !(ctx = exifctxnew()))
+		exifdie("can't allocate context");
+
+	asciiexif(b, EXIF_T_EQUIPMAKE, "HP");
+	b[20] = 3;
+	memcpy(b + 24, "HP\0\0", 4);
+
+	check(exifincbegin(ctx, len) == EXIF_OK, "exifincbegin() failed");
+	exifincadd(ctx, 0, b, 32);
+	check(ctx->needlen && ctx->needoff == off,
+	    "incremental scan didn't wait for an inline Make's offset");
+	more = exifincadd(ctx, off, b + off, len - off);
+	check(!more && ctx->error == EXIF_OK,
+	    "incremental scan didn't finish with an inline Make");
+
+	exifctxfree(ctx);
+	free(b);
+}
+
+
+/*
+ * Check that two scans found the same properties.
+ */
+static int
+sameprops(struct exiftags *a, struct exiftags *b)
+{
+	struct exifprop *p, *q;
+	char *s1, *s2;
+
+	if (!a || !b)
+		return (FALSE);
+	for (p = a->props, q = b->props; p && q; p = p->next, q = q->next) {
+		if (p->tag != q->tag || p->type != q->type ||
+		    p->count != q->count || p->value != q->value ||
+		    p->lvl != q->lvl)
+			return (FALSE);
+		s1 = propstr(p, a);
+		s2 = propstr(q, b);
+		if ((s1 || s2) && (!s1 || !s2 || strcmp(s1, s2)))
+			return (FALSE);
+	}
+	return (!p && !q);
+}
+
+
+/*
+ * Feed a section to an incremental scan in pieces, both where the scan
+ * asks for them and front to back regardless, and check that it ends
+ * up with what a single-shot scan or parse of the whole thing does.
+ */
+static void
+incpieces(const unsigned char *sect, size_t len, const char *name)
+{
+	struct exifctx *ctx, *ref;
+	struct exiftags *t;
+	unsigned char *b;
+	size_t off, n;
+	int more, i;
+
+	if (!(b = (unsigned char *)malloc(len)) || !(ctx = exifctxnew()) ||
+	    !(ref = exifctxnew()))
+		exifdie("can't allocate context");
+	memcpy(b, sect, len);
+
+	/* Five bytes at a time, wherever the scan wants them. */
+
+	checksect(exifincbegin(ctx, len) == EXIF_OK, name,
+	    "exifincbegin() failed");
+	for (more = TRUE, i = 0; more && ctx->needlen && i < 1000; i++) {
+		n = ctx->needlen < 5 ? ctx->needlen : 5;
+		more = exifincadd(ctx, ctx->needoff, b + ctx->needoff, n);
+	}
+	checksect(!more && ctx->error == EXIF_OK, name,
+	    "incremental scan didn't finish when fed what it asked for");
+	t = exifincscan(ctx, TRUE);
+	checksect(sameprops(t, exifctxscan(ref, b, (int)len, TRUE)), name,
+	    "incremental scan differs from a single-shot one");
+
+	/* Seven bytes at a time, in order. */
+
+	checksect(exifincbegin(ctx, len) == EXIF_OK, name,
+	    "exifincbegin() failed");
+	for (more = TRUE, off = 0; more && off < len; off += n) {
+		n = len - off < 7 ? len - off : 7;
+		more = exifincadd(ctx, off, b + off, n);
+	}
+	checksect(!more && ctx->error == EXIF_OK, name,
+	    "incremental scan didn't finish when fed in order");
+	t = exifincparse(ctx);
+	checksect(sameprops(t, exifctxparse(ref, b, (int)len)), name,
+	    "incremental parse differs from a single-shot one");
+
+	exifctxfree(ref);
+	exifctxfree(ctx);
+	free(b);
+}
+
+
+/*
+ * A section that links IFD after IFD mustn't keep an incremental scan
+ * probing forever; it should stop with EXIF_ELIMIT, and still report
+ * what it found.
+ */
+static void
+incprobecap(void)
+{
+	struct exifctx *ctx;
+	struct exiftags *t;
+	unsigned char *b, *p;
+	size_t len;
+	int more, i;
+
+	len = 14 + CHAINIFDS * 18;
+	if (!(b = (unsigned char *)calloc(1, len)) || !(ctx = exifctxnew()))
+		exifdie("can't allocate context");
+
+	/* Each IFD has just an inline Software, and points to the next. */
+
+	memcpy(b, minexif, 14);
+	for (i = 0; i < CHAINIFDS; i++) {
+		p = b + 14 + i * 18;
+		memcpy(p, "\001\000\061\001\002\000\004\000\000\000abc", 14);
+		if (i < CHAINIFDS - 1) {
+			p[14] = (8 + (i + 1) * 18) & 0xff;
+			p[15] = (8 + (i + 1) * 18) >> 8;
+		}
+	}
+
+	t = exifctxscan(ctx, b, (int)len, FALSE);
+	check(t && ctx->error == EXIF_OK, "IFD chain doesn't scan");
+
+	check(exifincbegin(ctx, len) == EXIF_OK, "exifincbegin() failed");
+	for (more = TRUE, i = 0; more && ctx->needlen && i < 1000; i++)
+		more = exifincadd(ctx, ctx->needoff, b + ctx->needoff,
+		    ctx->needlen);
+	check(!more && ctx->error == EXIF_ELIMIT,
+	    "incremental scan of an IFD chain wasn't capped");
+	t = exifincscan(ctx, FALSE);
+	check(t && t->props && ctx->error == EXIF_ELIMIT,
+	    "capped incremental scan didn't report what it found");
+
+	exifctxfree(ctx);
+	free(b);
+}
+
+
+int
+main(int argc, char **argv)
+{
+
+	progname = argv[0];
+	(void)argc;
+
+	proplimit();
+
+	tmcheck("2004:05:06 07:08:09", TRUE, 2004, 9);
+	tmcheck("2004:5:6 7:8:9", TRUE, 2004, 9);
+	tmcheck("  2004:05:06   07:08:09  ", TRUE, 2004, 9);
+	tmcheck("+2004:05:06 07:08:-9", TRUE, 2004, -9);
+	tmcheck("2004:05:06 07:08", FALSE, 0, 0);
+	tmcheck("2004-05-06 07:08:09", FALSE, 0, 0);
+
+	incinline();
+	incpieces(minexif, sizeof(minexif), "minexif");
+	incpieces(nestexif, sizeof(nestexif), "nestexif");
+	incprobecap();
+
+	if (!failed)
+		printf("%s: all tests passed\n", progname);
+	return (failed);
+}
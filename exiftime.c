@@ -71,6 +71,7 @@ static const char *delim = ": ";
 static const char *fname;
 static struct vary *v;
 static struct linfo *lorder;
+static struct exifctx *ctx;
 
 #define EXIFTIMEFMT	"%Y:%m:%d %H:%M:%S"
 #define EXIFTIMELEN	20
@@ -79,6 +80,15 @@ static struct linfo *lorder;
 #define ET_GEN		0x02
 #define ET_DIGI		0x04
 
+/* The timestamps we need from exifscansel(). */
+
+static struct exifsel tssel[] = {
+	{ tags, EXIF_T_DATETIME },
+	{ tags, EXIF_T_DATETIMEORIG },
+	{ tags, EXIF_T_DATETIMEDIGI },
+	{ NULL, EXIF_T_UNKNOWN },
+};
+
 
 /*
  * Some helpful info...
@@ -131,22 +141,16 @@ lcomp(const void *a, const void *b)
 
 
 /*
- * Stuff a standard Exif timestamp into a struct *tm.
- * I've got to say that it's pretty annoying that Win32 doesn't have
- * strptime()...
+ * Lookup a timestamp property, with its string ready to use.
  */
-static int
-etstrptm(const char *buf, struct tm *tp)
+static struct exifprop *
+findts(struct exiftags *t, u_int16_t tag)
 {
-	int n;
-
-	memset(tp, 0, sizeof(struct tm));
-	n = sscanf(buf, "%d:%d:%d %d:%d:%d", &tp->tm_year, &tp->tm_mon,
-	    &tp->tm_mday, &tp->tm_hour, &tp->tm_min, &tp->tm_sec);
-	tp->tm_year -= 1900;
-	tp->tm_mon -= 1;
+	struct exifprop *p;
 
-	return (n != 6);
+	if ((p = findprop(t, tags, tag)))
+		propstr(p, t);
+	return (p);
 }
 
 
@@ -163,15 +167,15 @@ listts(FILE *fp, struct exiftags *t, struct linfo *li, u_int16_t *tpref)
 
 	/* If no timestamp is found, print error and list first. */
 
-	p = findprop(t->props, tags, tpref[0]);
+	p = findts(t, tpref[0]);
 
-	if (!p || !p->str || etstrptm(p->str, &tv)) {
-		p = findprop(t->props, tags, tpref[1]);
+	if (!p || !p->str || !proptm(p, t, &tv)) {
+		p = findts(t, tpref[1]);
 
-		if (!p || !p->str || etstrptm(p->str, &tv)) {
-			p = findprop(t->props, tags, tpref[2]);
+		if (!p || !p->str || !proptm(p, t, &tv)) {
+			p = findts(t, tpref[2]);
 
-			if (!p || !p->str || etstrptm(p->str, &tv)) {
+			if (!p || !p->str || !proptm(p, t, &tv)) {
 				exifwarn("no timestamp available; using mtime");
 				fstat(fileno(fp), &finfo);
 				li->ts = finfo.st_mtime;
@@ -190,14 +194,14 @@ listts(FILE *fp, struct exiftags *t, struct linfo *li, u_int16_t *tpref)
  * The provided buffer must be at least EXIFTIMELEN bytes.
  */
 static int
-ettime(char *b, struct exifprop *p)
+ettime(char *b, struct exifprop *p, struct exiftags *t)
 {
 	struct tm tv;
 	const struct vary *badv;
 
 	/* Slurp the timestamp into tv. */
 
-	if (!p || !p->str || etstrptm(p->str, &tv))
+	if (!p || !p->str || !proptm(p, t, &tv))
 		return (1);
 
 	/* Apply any adjustments.  (Bad adjustment = fatal.) */
@@ -287,8 +291,8 @@ procts(FILE *fp, long pos, struct exiftags *t, const unsigned char *buf,
 	char nts[EXIFTIMELEN];
 	struct exifprop *p;
 
-	p = findprop(t->props, tags, tag);
-	if (ettime(nts, p)) {
+	p = findts(t, tag);
+	if (ettime(nts, p, t)) {
 
 		/*
 		 * If ttags != 0, then the user explicitly requested the
@@ -325,7 +329,7 @@ copyts(FILE *fp, long pos, struct exiftags *t, const unsigned char *buf,
 	int rc;
 	struct exifprop *p;
 
-	p = findprop(t->props, tags, tag);
+	p = findts(t, tag);
 	if (!p) {
 		fprintf(stderr, "%s: image %s time not available\n",
 		    fname, ttype);
@@ -352,8 +356,8 @@ copyallts(FILE *fp, long pos, struct exiftags *t, const unsigned char *buf,
 	char nts[EXIFTIMELEN];
 	struct exifprop *p;
 
-	p = findprop(t->props, tags, tag);
-	if (ettime(nts, p)) {
+	p = findts(t, tag);
+	if (ettime(nts, p, t)) {
 		fprintf(stderr, "%s: image %s time not available\n",
 		    fname, ttype);
 		return (1);
@@ -455,6 +459,7 @@ doit(FILE *fp, int n, u_int16_t *tpref)
 	unsigned int len, rlen;
 	unsigned char *exifbuf;
 	struct exiftags *t;
+	struct jpegstate js;
 	long app1;
 
 	gotapp1 = FALSE;
@@ -462,30 +467,31 @@ doit(FILE *fp, int n, u_int16_t *tpref)
 	exifbuf = NULL;
 	rc = 0;
 
-	while (jpegscan(fp, &mark, &len, !(first++))) {
+	/* Start fresh, giving back anything the last file needed. */
+
+	exifctxreset(ctx);
 
-		if (mark != JPEG_M_APP1) {
-			if (fseek(fp, len, SEEK_CUR))
-				exifdie((const char *)strerror(errno));
+	while (jpegscan(fp, &mark, &len, !(first++), &js)) {
+		exifwarndiags(js.diags);
+
+		if (mark != JPEG_M_APP1)
 			continue;
-		}
 
-		exifbuf = (unsigned char *)malloc(len);
-		if (!exifbuf)
+		if (!(exifbuf = exifctxbuf(ctx, len)))
 			exifdie((const char *)strerror(errno));
 
-		app1 = ftell(fp);
-		rlen = fread(exifbuf, 1, len, fp);
+		app1 = jpegtell(&js);
+		rlen = jpegdata(exifbuf, len, &js);
 		if (rlen != len) {
 			fprintf(stderr, "%s: error reading JPEG (length "
 			    "mismatch)\n", fname);
-			free(exifbuf);
 			return (1);
 		}
 
-		t = exifscan(exifbuf, len, FALSE);
+		t = exifctxscansel(ctx, exifbuf, len, tssel);
+		exifwarndiags(ctx->diags);
 
-		if (t && t->props) {
+		if (t && (t->props || t->nskip)) {
 			gotapp1 = TRUE;
 			if (lflag)
 				rc = listts(fp, t, &lorder[n], tpref);
@@ -493,9 +499,14 @@ doit(FILE *fp, int n, u_int16_t *tpref)
 				rc = procall(fp, app1, t, exifbuf);
 		}
 		exiffree(t);
-		free(exifbuf);
 	}
 
+	/* We don't go on after a bad JPEG. */
+
+	exifwarndiags(js.diags);
+	if (js.error)
+		exit(1);
+
 	if (!gotapp1) {
 		fprintf(stderr, "%s: couldn't find Exif data\n", fname);
 		return (1);
@@ -543,7 +554,6 @@ main(int argc, char **argv)
 	u_int16_t tpref[3];
 
 	progname = argv[0];
-	debug = FALSE;
 	ttags = ctags = wantall = eval = 0;
 	lflag = qflag = wflag = FALSE;
 	iflag = TRUE;
@@ -669,6 +679,9 @@ main(int argc, char **argv)
 			exifdie((const char *)strerror(errno));
 	}
 
+	if (!(ctx = exifctxnew()))
+		exifdie((const char *)strerror(errno));
+
 	/* Run through the files... */
 
 	for (fnum = 0; *argv; ++argv, fnum++) {
@@ -711,5 +724,6 @@ main(int argc, char **argv)
 	}
 
 	vary_destroy(v);
+	exifctxfree(ctx);
 	return (eval);
 }
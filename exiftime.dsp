@@ -93,6 +93,10 @@ SOURCE=.\exifgps.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\exifinc.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\exiftime.c
 # End Source File
 # Begin Source File
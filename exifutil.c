@@ -40,7 +40,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <errno.h>
+#include <setjmp.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#endif
 
 #include "exif.h"
 #include "exifint.h"
@@ -50,12 +57,12 @@
  * Some global variables we all need.
  */
 
-int debug;
 const char *progname;
 
 
 /*
- * Logging and error functions.
+ * Logging and error functions.  These are for the programs; the library
+ * itself doesn't print anything, but leaves diagnostics in its context.
  */
 void
 exifdie(const char *msg)
@@ -79,10 +86,137 @@ exifwarn2(const char *msg1, const char *msg2)
 	fprintf(stderr, "%s: %s (%s)\n", progname, msg1, msg2);
 }
 
+void
+exifwarndiags(struct exifdiag *diags)
+{
+
+	for (; diags; diags = diags->next) {
+		if (diags->arg)
+			exifwarn2(diags->msg, diags->arg);
+		else
+			exifwarn(diags->msg);
+	}
+}
+
+
+/*
+ * Add a diagnostic record to a context's list.  If there's no memory
+ * for it, it's dropped, except that an error gets the spare record.
+ */
+static void
+diagadd(struct exifctx *ctx, int code, const char *msg, const char *arg)
+{
+	struct exifdiag *d;
+
+	d = (struct exifdiag *)exifmemtry((struct exifmem *)ctx->mem,
+	    sizeof(struct exifdiag));
+	if (!d) {
+		if (code == EXIF_OK || ctx->faildiag.msg)
+			return;
+		d = &ctx->faildiag;
+	}
+	d->code = code;
+	d->msg = msg;
+	d->arg = arg;
+	d->next = NULL;
+
+	if (ctx->lastdiag)
+		ctx->lastdiag->next = d;
+	else
+		ctx->diags = d;
+	ctx->lastdiag = d;
+}
+
+
+/*
+ * Note a problem with the data; the parse goes on.
+ */
+void
+exifnote(const char *msg, const char *arg, struct exiftags *t)
+{
+
+	diagadd(t->ctx, EXIF_OK, msg, arg);
+}
+
+
+/*
+ * Fail the current parse, returning to its caller with the error.  Only
+ * for use within a parse or propstr(), which catch the failure.
+ */
+void
+exiffail(struct exifctx *ctx, int code, const char *msg)
+{
+
+	if (ctx->error == EXIF_OK)
+		ctx->error = code;
+	diagadd(ctx, code, msg, NULL);
+	if (ctx->fail)
+		longjmp(*(jmp_buf *)ctx->fail, 1);
+}
+
+
+/*
+ * Stop the current parse at one of its context's limits.  What's been
+ * read so far is kept (see run() in exif.c).
+ */
+void
+exiflimit(struct exifctx *ctx, const char *msg)
+{
+
+	/*
+	 * Only the first limit counts, and only during a parse: work done
+	 * on its properties afterward (e.g., formatting one with propstr())
+	 * isn't held to them.
+	 */
+
+	if (ctx->error == EXIF_OK && ctx->fail && ctx->cur)
+		exiffail(ctx, EXIF_ELIMIT, msg);
+}
+
+
+/*
+ * Milliseconds for timing parses; only differences mean anything.  We
+ * want a monotonic clock, so that setting the time of day doesn't cut
+ * a parse short or let it run on; the time of day is the fallback.
+ */
+u_int32_t
+exifmsecs(void)
+{
+#ifdef WIN32
+	return ((u_int32_t)GetTickCount());
+#else
+	struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+		return ((u_int32_t)ts.tv_sec * 1000 +
+		    (u_int32_t)ts.tv_nsec / 1000000);
+#endif
+
+	gettimeofday(&tv, NULL);
+	return ((u_int32_t)tv.tv_sec * 1000 + (u_int32_t)tv.tv_usec / 1000);
+#endif
+}
+
+
+/*
+ * Check whether the current parse has run out of time.
+ */
+void
+exiftimeout(struct exifctx *ctx)
+{
+
+	if (ctx->limits.msecs &&
+	    exifmsecs() - ctx->used.msecs > ctx->limits.msecs)
+		exiflimit(ctx, "parse stopped: out of time");
+}
+
 
 /*
  * Sanity check a tag's count & value when used as an offset within
- * the TIFF.  Checks for overflows.  Returns 0 if OK; !0 if not OK.
+ * the TIFF.  Checks for overflows.  Returns 0 if OK; !0 if not OK (or,
+ * if the section's coming in pieces, if the data hasn't arrived yet).
  */
 int
 offsanity(struct exifprop *prop, u_int16_t size, struct ifd *dir)
@@ -99,7 +233,7 @@ offsanity(struct exifprop *prop, u_int16_t size, struct ifd *dir)
 
 	if (!prop->count) {
 		if (prop->value > tifflen) {
-			exifwarn2("invalid field offset", name);
+			exifnote("invalid field offset", name, dir->md.t);
 			prop->lvl = ED_BAD;
 			return (1);
 		}
@@ -109,7 +243,7 @@ offsanity(struct exifprop *prop, u_int16_t size, struct ifd *dir)
 	/* Does count * size overflow? */
 
 	if (size > (u_int32_t)(-1) / prop->count) {
-		exifwarn2("invalid field count", name);
+		exifnote("invalid field count", name, dir->md.t);
 		prop->lvl = ED_BAD;
 		return (1);
 	}
@@ -117,7 +251,7 @@ offsanity(struct exifprop *prop, u_int16_t size, struct ifd *dir)
 	/* Does count * size + value overflow? */
 
 	if ((u_int32_t)(-1) - prop->value < prop->count * size) {
-		exifwarn2("invalid field offset", name);
+		exifnote("invalid field offset", name, dir->md.t);
 		prop->lvl = ED_BAD;
 		return (1);
 	}
@@ -125,11 +259,20 @@ offsanity(struct exifprop *prop, u_int16_t size, struct ifd *dir)
 	/* Is the offset valid? */
 
 	if (prop->value + prop->count * size > tifflen) {
-		exifwarn2("invalid field offset", name);
+		exifnote("invalid field offset", name, dir->md.t);
 		prop->lvl = ED_BAD;
 		return (1);
 	}
 
+	/*
+	 * Is it here?  (readtag() only checks values too big to fit in
+	 * the field, but some small ones are read as offsets anyway.)
+	 */
+
+	if (exifincmiss(dir->md.t->ctx, dir->md.btiff, prop->value,
+	    prop->count * size))
+		return (1);
+
 	return (0);
 }
 
@@ -142,9 +285,9 @@ exif2byte(unsigned char *b, enum byteorder o)
 {
 
 	if (o == BIG)
-		return ((b[0] << 8) | b[1]);
+		return (EXIF2BE(b));
 	else
-		return ((b[1] << 8) | b[0]);
+		return (EXIF2LE(b));
 }
 
 
@@ -156,9 +299,9 @@ exif2sbyte(unsigned char *b, enum byteorder o)
 {
 
 	if (o == BIG)
-		return ((b[0] << 8) | b[1]);
+		return ((int16_t)EXIF2BE(b));
 	else
-		return ((b[1] << 8) | b[0]);
+		return ((int16_t)EXIF2LE(b));
 }
 
 
@@ -170,9 +313,9 @@ exif4byte(unsigned char *b, enum byteorder o)
 {
 
 	if (o == BIG)
-		return ((b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]);
+		return (EXIF4BE(b));
 	else
-		return ((b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0]);
+		return (EXIF4LE(b));
 }
 
 
@@ -201,26 +344,292 @@ exif4sbyte(unsigned char *b, enum byteorder o)
 {
 
 	if (o == BIG)
-		return ((b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]);
+		return ((int32_t)EXIF4BE(b));
 	else
-		return ((b[3] << 24) | (b[2] << 16) | (b[1] << 8) | b[0]);
+		return ((int32_t)EXIF4LE(b));
+}
+
+
+/*
+ * Hash a tag for a tag definition index.
+ */
+static u_int32_t
+taghash(u_int16_t tag)
+{
+	u_int32_t h;
+
+	h = (u_int32_t)tag * 0x9e3779b1U;
+	return (h ^ (h >> 16));
 }
 
 
 /*
- * Lookup and allocate description for a value.
+ * Hash a table address for the registry.
  */
-char *
-finddescr(struct descrip *table, u_int16_t val)
+static u_int32_t
+tblhash(const void *table)
 {
+	u_int32_t h;
+
+	h = (u_int32_t)((unsigned long)table >> 3) * 0x9e3779b1U;
+	return (h ^ (h >> 16));
+}
+
+
+/*
+ * Table indexes are built once per process, the first time a table is
+ * searched, and shared by every context after that.  They're carved
+ * from static pools and never freed; the pools have plenty of room for
+ * the tables we have, but should they run out, the table is simply
+ * scanned.  The registry is only touched under a lock, so each context
+ * remembers the indexes it has used in a small cache of its own.
+ */
+
+static struct tblreg tblregs[TBLREGMAX];
+
+static struct tagidx tagidxs[TAGIDXPOOL];
+static u_int32_t ntagidx;
+static u_int16_t tagslots[TAGSLOTPOOL];
+static u_int32_t ntagslots;
+
+static struct descidx descidxs[DESCIDXPOOL];
+static u_int32_t ndescidx;
+static u_int16_t descslots[DESCSLOTPOOL];
+static u_int32_t ndescslots;
+
+#ifdef WIN32
+static volatile LONG tbllk;
+#define TBLLOCK()	while (InterlockedExchange(&tbllk, 1)) Sleep(0)
+#define TBLUNLOCK()	InterlockedExchange(&tbllk, 0)
+#else
+static pthread_mutex_t tbllk = PTHREAD_MUTEX_INITIALIZER;
+#define TBLLOCK()	pthread_mutex_lock(&tbllk)
+#define TBLUNLOCK()	pthread_mutex_unlock(&tbllk)
+#endif
+
+
+/*
+ * Find a table's index in the registry; NULL if it hasn't been built.
+ * Called with the lock held.
+ */
+static void *
+tblfind(const void *table)
+{
+	u_int32_t h;
+
+	h = tblhash(table) & (TBLREGMAX - 1);
+	while (tblregs[h].table) {
+		if (tblregs[h].table == table)
+			return (tblregs[h].idx);
+		h = (h + 1) & (TBLREGMAX - 1);
+	}
+	return (NULL);
+}
+
+
+/*
+ * Register a table's index.  Called with the lock held; the pools are
+ * small enough relative to the registry that it can't fill.
+ */
+static void
+tblreg(const void *table, void *idx)
+{
+	u_int32_t h;
+
+	h = tblhash(table) & (TBLREGMAX - 1);
+	while (tblregs[h].table)
+		h = (h + 1) & (TBLREGMAX - 1);
+	tblregs[h].table = table;
+	tblregs[h].idx = idx;
+}
+
+
+/*
+ * Build the index for a tag definition table.  Where a tag is listed
+ * more than once, the first entry wins, as it did with a linear scan.
+ * Returns NULL if the pools are exhausted.  Called with the lock held.
+ */
+static struct tagidx *
+tagidxbuild(struct exiftag *table)
+{
+	struct tagidx *ti;
+	u_int32_t i, n, h;
+
+	for (n = 0; table[n].tag < EXIF_T_UNKNOWN; n++);
+
+	for (h = TAGIDXMIN; h < n * 2; h <<= 1);
+	if (ntagidx == TAGIDXPOOL || TAGSLOTPOOL - ntagslots < h)
+		return (NULL);
+	ti = &tagidxs[ntagidx++];
+	ti->size = h;
+	ti->slots = &tagslots[ntagslots];
+	ntagslots += h;
+	ti->table = table;
+	ti->unkn = (u_int16_t)n;
+
+	for (i = 0; i < n; i++) {
+		h = taghash(table[i].tag) & (ti->size - 1);
+		while (ti->slots[h] && table[ti->slots[h] - 1].tag !=
+		    table[i].tag)
+			h = (h + 1) & (ti->size - 1);
+		if (!ti->slots[h])
+			ti->slots[h] = (u_int16_t)(i + 1);
+	}
+	return (ti);
+}
+
+
+/*
+ * Build the index for a value description table.  Values are looked up
+ * directly by their offset from the lowest one, unless the table is too
+ * sparse for that to be worthwhile.  First entry for a value wins.
+ * Returns NULL if the pools are exhausted.  Called with the lock held.
+ */
+static struct descidx *
+descidxbuild(struct descrip *table)
+{
+	struct descidx *di;
+	int32_t lo, hi;
+	u_int32_t i, n, span;
+
+	lo = hi = 0;
+	for (n = 0; table[n].val != -1; n++) {
+		if (!n || table[n].val < lo)
+			lo = table[n].val;
+		if (!n || table[n].val > hi)
+			hi = table[n].val;
+	}
+
+	span = n && hi - lo < DESCIDXMAX ? (u_int32_t)(hi - lo + 1) : 0;
+	if (ndescidx == DESCIDXPOOL || DESCSLOTPOOL - ndescslots < span)
+		return (NULL);
+	di = &descidxs[ndescidx++];
+	di->base = lo;
+	di->span = span;
+	di->unkn = (u_int16_t)n;
+	di->slots = &descslots[ndescslots];
+	ndescslots += span;
+
+	if (!span)
+		return (di);
+	for (i = n; i > 0; i--)
+		di->slots[table[i - 1].val - lo] = (u_int16_t)i;
+	return (di);
+}
+
+
+/*
+ * Find a table's index, first in the context's cache, then in the
+ * registry, building it if need be.  Returns NULL if the pools have
+ * run out.
+ */
+static void *
+tblindex(const void *table, int desc, struct exiftags *t)
+{
+	struct tblreg *reg;
+	void *idx;
+
+	reg = &((struct tblcache *)t->tblcache)->regs[tblhash(table) &
+	    (TBLCACHESZ - 1)];
+	if (reg->table == table)
+		return (reg->idx);
+
+	TBLLOCK();
+	if (!(idx = tblfind(table))) {
+		if (desc)
+			idx = descidxbuild((struct descrip *)table);
+		else
+			idx = tagidxbuild((struct exiftag *)table);
+		if (idx)
+			tblreg(table, idx);
+	}
+	TBLUNLOCK();
+
+	if (idx) {
+		reg->table = table;
+		reg->idx = idx;
+	}
+	return (idx);
+}
+
+
+/*
+ * Lookup the definition of a tag in a table of tags.  Returns the
+ * table's terminating (unknown) entry if it isn't there.
+ */
+struct exiftag *
+findtag(struct exiftag *table, u_int16_t tag, struct exiftags *t)
+{
+	struct tagidx *ti;
+	u_int32_t h;
+	u_int16_t i;
+
+	/* Find (or build) the table's index. */
+
+	if (!(ti = (struct tagidx *)tblindex(table, FALSE, t))) {
+		for (i = 0; table[i].tag < EXIF_T_UNKNOWN &&
+		    table[i].tag != tag; i++);
+		return (&table[i]);
+	}
+
+	/* Now the tag itself. */
+
+	h = taghash(tag) & (ti->size - 1);
+	while ((i = ti->slots[h])) {
+		if (table[i - 1].tag == tag)
+			return (&table[i - 1]);
+		h = (h + 1) & (ti->size - 1);
+	}
+	return (&table[ti->unkn]);
+}
+
+
+/*
+ * Find a value's entry in a description table.  Returns the table's
+ * terminating (unknown) entry if it isn't there.
+ */
+static struct descrip *
+descrent(struct descrip *table, u_int16_t val, struct exiftags *t)
+{
+	struct descidx *di;
+	u_int32_t off;
 	int i;
-	char *c;
 
-	for (i = 0; table[i].val != -1 && table[i].val != val; i++);
-	if (!(c = (char *)malloc(strlen(table[i].descr) + 1)))
-		exifdie((const char *)strerror(errno));
-	strcpy(c, table[i].descr);
-	return (c);
+	di = (struct descidx *)tblindex(table, TRUE, t);
+	if (!di || !di->span) {
+		for (i = 0; table[i].val != -1 && table[i].val != val; i++);
+		return (&table[i]);
+	}
+
+	off = (u_int32_t)((int32_t)val - di->base);
+	if (off < di->span && di->slots[off])
+		return (&table[di->slots[off] - 1]);
+	return (&table[di->unkn]);
+}
+
+
+/*
+ * Lookup description for a value.  The string belongs to the table, so
+ * it mustn't be modified or freed.
+ */
+const char *
+finddescr(struct descrip *table, u_int16_t val, struct exiftags *t)
+{
+
+	return (descrent(table, val, t)->descr);
+}
+
+
+/*
+ * Set a property's string to the description for a value.
+ */
+void
+descrprop(struct exifprop *prop, struct descrip *table, u_int16_t val,
+    struct exiftags *t)
+{
+
+	prop->str = (char *)finddescr(table, val, t);
+	prop->flags |= PR_CONSTSTR;
 }
 
 
@@ -231,33 +640,36 @@ finddescr(struct descrip *table, u_int16_t val)
  * of destination buffer.
  */
 int
-catdescr(char *c, struct descrip *table, u_int16_t val, int len)
+catdescr(char *c, struct descrip *table, u_int16_t val, int len,
+    struct exiftags *t)
 {
-	int i, l;
+	struct descrip *d;
+	int l;
 
 	l = 0;
 	len -= 1;
 	c[len] = '\0';
 
-	for (i = 0; table[i].val != -1 && table[i].val != val; i++);
-	if (table[i].val == -1)
+	d = descrent(table, val, t);
+	if (d->val == -1)
 		return (0);
 
 	if (strlen(c)) {
 		strncat(c, ", ", len - strlen(c));
 		l += 2;
 	}
-	strncat(c, table[i].descr, len - strlen(c));
-	l += strlen(table[i].descr);
+	strncat(c, d->descr, len - strlen(c));
+	l += strlen(d->descr);
 	return (l);
 }
 
 
 /*
- * Lookup a property entry belonging to a particular set of tags.
+ * Lookup a property entry belonging to a particular set of tags, starting
+ * with the given property and walking the list.
  */
 struct exifprop *
-findprop(struct exifprop *prop, struct exiftag *tagset, u_int16_t tag)
+findnextprop(struct exifprop *prop, struct exiftag *tagset, u_int16_t tag)
 {
 
 	for (; prop && (prop->tagset != tagset || prop->tag != tag ||
@@ -266,19 +678,370 @@ findprop(struct exifprop *prop, struct exiftag *tagset, u_int16_t tag)
 }
 
 
+/*
+ * Hash a property key for the property index.
+ */
+static u_int32_t
+prophash(struct exiftag *tagset, u_int16_t tag)
+{
+	u_int32_t h;
+
+	h = (u_int32_t)((unsigned long)tagset >> 4) ^
+	    ((u_int32_t)tag * 0x9e3779b1U);
+	return (h ^ (h >> 16));
+}
+
+
+/*
+ * Add a property to the index.  If we're told its position relative to
+ * props with the same key isn't known, flag the key so lookups fall back
+ * to walking the list.
+ */
+static void
+idxinsert(struct propidx *idx, struct exifprop *prop, int amb)
+{
+	u_int32_t i;
+	int first = -1;
+
+	i = prophash(prop->tagset, prop->tag) & (idx->size - 1);
+	while (idx->slots[i]) {
+		if (first == -1 && idx->slots[i]->tagset == prop->tagset &&
+		    idx->slots[i]->tag == prop->tag)
+			first = i;
+		i = (i + 1) & (idx->size - 1);
+	}
+	idx->slots[i] = prop;
+	idx->used++;
+
+	if (amb && first != -1)
+		idx->amb[first] = 1;
+}
+
+
+/*
+ * (Re)build the property index from the property list.  Returns NULL
+ * if there's no memory for it; lookups can always fall back on the list.
+ */
+static struct propidx *
+idxbuild(struct exiftags *t)
+{
+	struct propidx *idx;
+	struct exifprop *prop, **slots;
+	unsigned char *amb;
+	u_int32_t n, size;
+
+	for (n = 0, prop = t->props; prop; prop = prop->next, n++);
+	for (size = PROPIDXMIN; size < n * 2; size <<= 1);
+
+	if (!(idx = (struct propidx *)t->propidx)) {
+		idx = (struct propidx *)exifmemtry(t->md.mem,
+		    sizeof(struct propidx));
+		if (!idx)
+			return (NULL);
+	}
+	if (idx->size < size) {
+		slots = (struct exifprop **)exifmemtry(t->md.mem,
+		    size * sizeof(struct exifprop *));
+		amb = (unsigned char *)exifmemtry(t->md.mem, size);
+		if (!slots || !amb)
+			return (NULL);
+		idx->slots = slots;
+		idx->amb = amb;
+		idx->size = size;
+	} else {
+		memset(idx->slots, 0, idx->size * sizeof(struct exifprop *));
+		memset(idx->amb, 0, idx->size);
+	}
+	idx->used = idx->npend = 0;
+
+	for (prop = t->props; prop; prop = prop->next)
+		idxinsert(idx, prop, FALSE);
+	t->propidx = (void *)idx;
+	return (idx);
+}
+
+
+/*
+ * Bring the index back in line with the list after props have been
+ * taken off it (see visitifd()).
+ */
+void
+propreindex(struct exiftags *t)
+{
+
+	if (t->propidx && !idxbuild(t))
+		t->propidx = NULL;
+}
+
+
+/*
+ * Note a property that's just been added to the list.  It's hashed on
+ * the next lookup, once its caller has filled in tagset and tag.  amb
+ * says it didn't go on the end of the list, so it may come ahead of
+ * props with the same key that were hashed before it.
+ */
+void
+propindex(struct exifprop *prop, struct exiftags *t, int amb)
+{
+	struct propidx *idx;
+	struct idxpend *pend;
+
+	if (!(idx = (struct propidx *)t->propidx))
+		return;
+
+	if (idx->npend == idx->maxpend) {
+		idx->maxpend = idx->maxpend ? idx->maxpend * 2 : PROPIDXMIN;
+		pend = (struct idxpend *)exifmemalloc(t->md.mem,
+		    idx->maxpend * sizeof(struct idxpend));
+		if (idx->npend)
+			memcpy(pend, idx->pend,
+			    idx->npend * sizeof(struct idxpend));
+		idx->pend = pend;
+	}
+	idx->pend[idx->npend].prop = prop;
+	idx->pend[idx->npend++].amb = amb;
+}
+
+
+/*
+ * Lookup a property entry belonging to a particular set of tags.
+ */
+struct exifprop *
+findprop(struct exiftags *t, struct exiftag *tagset, u_int16_t tag)
+{
+	struct propidx *idx;
+	struct exifprop *prop;
+	u_int32_t i;
+
+	if (!t) return (NULL);
+
+	/* Bring the index up to date. */
+
+	idx = (struct propidx *)t->propidx;
+	if (!idx || (idx->used + idx->npend) * 2 > idx->size) {
+		if (!(idx = idxbuild(t)))
+			return (findnextprop(t->props, tagset, tag));
+	} else {
+		for (i = 0; i < idx->npend; i++)
+			idxinsert(idx, idx->pend[i].prop,
+			    idx->pend[i].amb);
+		idx->npend = 0;
+	}
+
+	/* First non-bad entry for the key, in list order. */
+
+	i = prophash(tagset, tag) & (idx->size - 1);
+	for (; (prop = idx->slots[i]); i = (i + 1) & (idx->size - 1)) {
+		if (prop->tagset != tagset || prop->tag != tag)
+			continue;
+		if (idx->amb[i])
+			return (findnextprop(t->props, tagset, tag));
+		if (prop->lvl != ED_BAD)
+			return (prop);
+	}
+	return (NULL);
+}
+
+
+/*
+ * Allocate and free memory through a context's allocator.
+ */
+void *
+allocmem(struct exifctx *ctx, size_t len)
+{
+
+	return (ctx->alloc.alloc(len, ctx->alloc.arg));
+}
+
+void
+freemem(struct exifctx *ctx, void *p)
+{
+
+	if (p)
+		ctx->alloc.release(p, ctx->alloc.arg);
+}
+
+
+/*
+ * Create a new parse memory arena.
+ */
+struct exifmem *
+exifmemnew(struct exifctx *ctx)
+{
+	struct exifmem *mem;
+
+	mem = (struct exifmem *)allocmem(ctx, sizeof(struct exifmem));
+	if (!mem)
+		return (NULL);
+	mem->first = mem->cur = NULL;
+	mem->ctx = ctx;
+	return (mem);
+}
+
+
+/*
+ * Allocate zeroed memory from a parse memory arena.  Blocks left over
+ * from a previous exifmemtrim() are reused before new ones are added.
+ * Returns NULL if the arena can't grow.
+ */
+void *
+exifmemtry(struct exifmem *mem, size_t len)
+{
+	struct memblk *blk;
+	size_t hdr, sz;
+	unsigned char *p;
+
+	/* Keep everything aligned for the strictest type we hand out. */
+
+	hdr = (sizeof(struct memblk) + sizeof(union memalign) - 1) &
+	    ~(sizeof(union memalign) - 1);
+	len = (len + sizeof(union memalign) - 1) &
+	    ~(sizeof(union memalign) - 1);
+	if (!len)
+		len = sizeof(union memalign);
+
+	blk = mem->cur;
+	if (blk && blk->size - blk->used < len) {
+		blk = blk->next;
+		if (blk && blk->size < len)
+			blk = NULL;
+	}
+
+	if (!blk || blk->size - blk->used < len) {
+		sz = len > MEMBLKSZ ? len : MEMBLKSZ;
+		if (!(blk = (struct memblk *)allocmem(mem->ctx, hdr + sz)))
+			return (NULL);
+		blk->size = sz;
+		blk->used = 0;
+
+		/* Put it after the current block so spares stay in front. */
+
+		if (mem->cur) {
+			blk->next = mem->cur->next;
+			mem->cur->next = blk;
+		} else {
+			blk->next = mem->first;
+			mem->first = blk;
+		}
+	}
+	mem->cur = blk;
+
+	p = (unsigned char *)blk + hdr + blk->used;
+	blk->used += len;
+	mem->ctx->used.bytes += len;
+	memset(p, 0, len);
+	return ((void *)p);
+}
+
+
+/*
+ * Like exifmemtry(), but failing the parse if the arena can't grow (or
+ * the parse has had its share).
+ */
+void *
+exifmemalloc(struct exifmem *mem, size_t len)
+{
+	struct exifctx *ctx = mem->ctx;
+	void *p;
+
+	if (!(p = exifmemtry(mem, len)))
+		exiffail(ctx, EXIF_ENOMEM, "out of memory");
+	if (ctx->limits.bytes && ctx->used.bytes > ctx->limits.bytes)
+		exiflimit(ctx, "parse stopped: too much memory");
+	return (p);
+}
+
+
+/*
+ * Release everything allocated from an arena, keeping blocks totalling
+ * about keep bytes around for reuse.  (The first is always kept.)  Lets
+ * an arena give back what an unusually large parse took.
+ */
+void
+exifmemtrim(struct exifmem *mem, size_t keep)
+{
+	struct memblk *blk, **prev;
+	size_t total;
+
+	total = 0;
+	prev = &mem->first;
+	while ((blk = *prev)) {
+		if (blk != mem->first && total + blk->size > keep) {
+			*prev = blk->next;
+			freemem(mem->ctx, blk);
+			continue;
+		}
+		total += blk->size;
+		blk->used = 0;
+		prev = &blk->next;
+	}
+	mem->cur = mem->first;
+}
+
+
+/*
+ * Free an arena and all of its blocks.
+ */
+void
+exifmemfree(struct exifmem *mem)
+{
+	struct memblk *blk, *tmpblk;
+
+	if (!mem) return;
+
+	blk = mem->first;
+	while (blk) {
+		tmpblk = blk->next;
+		freemem(mem->ctx, blk);
+		blk = tmpblk;
+	}
+	freemem(mem->ctx, mem);
+}
+
+
+/*
+ * Look up the TIFF metadata of the IFD a property came from.  Can be
+ * NULL for one that didn't (a child made by a maker module).
+ */
+struct tiffmeta *
+propmd(struct exifprop *prop, struct exiftags *t)
+{
+	struct ifdmeta *im = (struct ifdmeta *)t->ifdmd;
+
+	if (!im || prop->type == TIFF_UNKN || prop->ifdseq < 0 ||
+	    prop->ifdseq >= im->num)
+		return (NULL);
+	return (im->md[prop->ifdseq]);
+}
+
+
 /*
  * Allocate memory for an Exif property.
  */
 struct exifprop *
-newprop(void)
+newprop(struct exiftags *t)
 {
+	struct exifctx *ctx = t->ctx;
+	struct visitscan *vs = (struct visitscan *)t->visit;
 	struct exifprop *prop;
 
-	prop = (struct exifprop *)malloc(sizeof(struct exifprop));
-	if (!prop)
-		exifdie((const char *)strerror(errno));
-	memset(prop, 0, sizeof(struct exifprop));
-	return (prop);
+	/* Every so often, see how long we've been at it. */
+
+	if (!(++ctx->used.props & 0x1f))
+		exiftimeout(ctx);
+	if (ctx->limits.props && ctx->used.props > ctx->limits.props)
+		exiflimit(ctx, "parse stopped: too many properties");
+
+	/* A visit hands back the ones it's done with. */
+
+	if (vs && (prop = vs->spare)) {
+		vs->spare = prop->next;
+		memset(prop, 0, sizeof(struct exifprop));
+		return (prop);
+	}
+
+	return ((struct exifprop *)exifmemalloc(t->propmem,
+	    sizeof(struct exifprop)));
 }
 
 
@@ -288,11 +1051,25 @@ newprop(void)
  * multiple items of interest.
  */
 struct exifprop *
-childprop(struct exifprop *parent)
+childprop(struct exifprop *parent, struct exiftags *t)
 {
+	struct exifctx *ctx = t->ctx;
 	struct exifprop *prop;
 
-	prop = newprop();
+	/*
+	 * Maker modules make a property's children all at once, so we
+	 * just count how many in a row share a parent.
+	 */
+
+	if (ctx->lastpar != (void *)parent) {
+		ctx->lastpar = (void *)parent;
+		ctx->used.children = 0;
+	}
+	if (ctx->limits.children &&
+	    ++ctx->used.children > ctx->limits.children)
+		exiflimit(ctx, "parse stopped: too many child properties");
+
+	prop = newprop(t);
 
 	/* By default, the child inherits most values from its parent. */
 
@@ -308,6 +1085,9 @@ childprop(struct exifprop *parent)
 	/* Now insert the new property into our list. */
 
 	parent->next = prop;
+	if (t->lastprop == parent)
+		t->lastprop = prop;
+	propindex(prop, t, prop->next != NULL);
 
 	return (prop);
 }
@@ -317,15 +1097,12 @@ childprop(struct exifprop *parent)
  * Allocate a buffer for a property's display string.
  */
 void
-exifstralloc(char **str, int len)
+exifstralloc(char **str, int len, struct exiftags *t)
 {
 
-	if (*str) {
-		exifwarn("tried to alloc over non-null string");
-		abort();
-	}
-	if (!(*str = (char *)calloc(1, len)))
-		exifdie((const char *)strerror(errno));
+	if (*str)
+		exifnote("tried to alloc over non-null string", NULL, t);
+	*str = (char *)exifmemalloc(t->md.mem, len);
 }
 
 
@@ -346,11 +1123,11 @@ hexprint(unsigned char *b, int len)
  * Print debug info for a property.
  */
 void
-dumpprop(struct exifprop *prop, struct field *afield)
+dumpprop(struct exifprop *prop, struct field *afield, struct exiftags *t)
 {
 	int i;
 
-	if (!debug) return;
+	if (!t->debug) return;
 
 	for (i = 0; ftypes[i].type && ftypes[i].type != prop->type; i++);
 	if (afield) {
@@ -384,6 +1161,7 @@ readifd(u_int32_t offset, struct ifd **dir, struct exiftag *tagset,
 	u_int32_t ifdsize, tifflen;
 	unsigned char *b;
 	struct ifdoff *ifdoffs, *lastoff;
+	struct exifctx *ctx = md->t->ctx;
 
 	tifflen = md->etiff - md->btiff;
 	b = md->btiff;
@@ -402,16 +1180,17 @@ readifd(u_int32_t offset, struct ifd **dir, struct exiftag *tagset,
 	}
 	if (ifdoffs) {
 		/* We'll only complain if debugging. */
-		if (debug) exifwarn("loop in IFD reference");
+		if (md->t->debug)
+			exifnote("loop in IFD reference", NULL, md->t);
 		return (0);
 	}
 
-	ifdoffs = (struct ifdoff *)malloc(sizeof(struct ifdoff));
-	if (!ifdoffs) {
-		exifwarn2("can't allocate IFD offset record",
-		    (const char *)strerror(errno));
-		return (0);
-	}
+	if (ctx->limits.ifds && ++ctx->used.ifds > ctx->limits.ifds)
+		exiflimit(ctx, "parse stopped: too many IFDs");
+	exiftimeout(ctx);
+
+	ifdoffs = (struct ifdoff *)exifmemalloc(md->mem,
+	    sizeof(struct ifdoff));
 	ifdoffs->offset = offset + b;
 	ifdoffs->next = NULL;
 
@@ -430,12 +1209,12 @@ readifd(u_int32_t offset, struct ifd **dir, struct exiftag *tagset,
 	if ((u_int32_t)(-1) - offset < 2 || offset + 2 > tifflen)
 		return (0);
 
-	*dir = (struct ifd *)malloc(sizeof(struct ifd));
-	if (!*dir) {
-		exifwarn2("can't allocate IFD record",
-		    (const char *)strerror(errno));
+	/* If the section's coming in pieces, the IFD may not be here. */
+
+	if (exifincmiss(ctx, b, offset, 2))
 		return (0);
-	}
+
+	*dir = (struct ifd *)exifmemalloc(md->mem, sizeof(struct ifd));
 
 	(*dir)->num = exif2byte(b + offset, md->order);
 	(*dir)->par = NULL;
@@ -447,7 +1226,6 @@ readifd(u_int32_t offset, struct ifd **dir, struct exiftag *tagset,
 
 	if ((*dir)->num &&
 	    sizeof(struct field) > (u_int32_t)(-1) / (*dir)->num) {
-		free(*dir);
 		*dir = NULL;
 		return (0);
 	}
@@ -458,8 +1236,8 @@ readifd(u_int32_t offset, struct ifd **dir, struct exiftag *tagset,
 	/* Sanity check our size (and check for overflows). */
 
 	if ((u_int32_t)(-1) - (offset + 2) < ifdsize ||
-	    offset + 2 + ifdsize > tifflen) {
-		free(*dir);
+	    offset + 2 + ifdsize > tifflen ||
+	    exifincmiss(ctx, md->btiff, offset + 2, ifdsize)) {
 		*dir = NULL;
 		return (0);
 	}
@@ -479,8 +1257,10 @@ readifd(u_int32_t offset, struct ifd **dir, struct exiftag *tagset,
 	 * standard IFDs.
 	 */
 
-	return ((b + ifdsize + 4 > md->etiff) ? 0 :
-	    exif4byte(b + ifdsize, md->order));
+	if (b + ifdsize + 4 > md->etiff ||
+	    exifincmiss(ctx, md->btiff, offset + 2 + ifdsize, 4))
+		return (0);
+	return (exif4byte(b + ifdsize, md->order));
 }
 
 
@@ -207,7 +207,7 @@ fuji_prop(struct exifprop *prop, struct exiftags *t)
 	case 0x0000:
 		if (prop->count != 4)
 			break;
-		exifstralloc(&prop->str, prop->count + 1);
+		exifstralloc(&prop->str, prop->count + 1, t);
 		byte4exif(prop->value, (unsigned char *)prop->str, LITTLE);
 		break;
 	}
@@ -43,24 +43,21 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <setjmp.h>
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "jpeg.h"
 #include "exif.h"
 
 
-static FILE *infile;
-
-/* Some data we collect from a start of frame. */
-
-static int jpg_prcsn;			/* Precision. */
-static int jpg_cmpnts;			/* Number of components. */
-static unsigned int jpg_height;		/* Image height. */
-static unsigned int jpg_width;		/* Image width. */
-static const char *jpg_prcss;		/* Process. */
-
-static int seensof;
-
-
 /* Process string lookup table. */
 
 static struct jpgprocess {
@@ -85,34 +82,102 @@ static struct jpgprocess {
 
 
 /*
- * Fetch one byte of the JPEG file.
+ * Note a problem with the file.  Once the records are used up, we just
+ * keep the first ones.
+ */
+static void
+jpgnote(int code, const char *msg, struct jpegstate *js)
+{
+	struct exifdiag *d;
+
+	if (js->ndiag == JPEG_DIAGMAX)
+		return;
+	d = &js->diag[js->ndiag];
+	d->code = code;
+	d->msg = msg;
+	d->arg = NULL;
+	d->next = NULL;
+	if (js->ndiag++)
+		js->diag[js->ndiag - 2].next = d;
+	else
+		js->diags = d;
+}
+
+
+/*
+ * Give up on a bad JPEG file, returning from jpegscanmem() or jpegscan().
+ */
+static void
+jpgfail(const char *msg, struct jpegstate *js)
+{
+
+	js->error = EXIF_EFORMAT;
+	jpgnote(EXIF_EFORMAT, msg, js);
+	longjmp(*(jmp_buf *)js->fail, 1);
+}
+
+
+/*
+ * Top up the window from the file so that it holds at least n bytes past
+ * where we are.  We read as much as fits, in one go, so the file is
+ * usually ahead of the window; see jpegtell().
  */
 static int
-jpg1byte(void)
+jpgfill(struct jpegstate *js, size_t n)
 {
-	int b;
+	size_t have;
+
+	have = js->buflen - js->pos;
+	if (have)
+		memmove(js->win, js->buf + js->pos, have);
+	js->buf = js->win;
+	js->pos = 0;
+	js->buflen = have + fread(js->win + have, 1, JPEG_WINLEN - have,
+	    js->fp);
+	return (js->buflen >= n);
+}
 
-	b = fgetc(infile);
-	if (b == EOF)
-		exifdie("invalid JPEG format");
-	return (b);
+
+/*
+ * Take n (no more than JPEG_WINLEN) bytes from the window, refilling it
+ * from the file, if there is one.
+ */
+static const unsigned char *
+jpgtake(size_t n, struct jpegstate *js)
+{
+
+	if (js->buflen - js->pos < n && (!js->fp || !jpgfill(js, n))) {
+		if (!js->fp)
+			js->need = js->pos + n;
+		js->pos = js->buflen;
+		jpgfail("invalid JPEG format", js);
+	}
+	js->pos += n;
+	return (js->buf + js->pos - n);
 }
 
 
 /*
- * Fetch two bytes of the JPEG file.
+ * Fetch one byte of the JPEG.
  */
-static unsigned int
-jpg2byte(void)
+static int
+jpg1byte(struct jpegstate *js)
 {
-	unsigned int b1, b2;
 
-	b1 = fgetc(infile);
-	b2 = fgetc(infile);
-	if (b1 == EOF || b2 == EOF)
-		exifdie("invalid JPEG format");
+	return (*jpgtake(1, js));
+}
+
+
+/*
+ * Fetch two bytes of the JPEG.
+ */
+static unsigned int
+jpg2byte(struct jpegstate *js)
+{
+	const unsigned char *b;
 
-	return ((b1 << 8) | b2);
+	b = jpgtake(2, js);
+	return ((b[0] << 8) | b[1]);
 }
 
 
@@ -120,44 +185,75 @@ jpg2byte(void)
  * Fetch the length of a marker.
  */
 static unsigned int
-mkrlen(void)
+mkrlen(struct jpegstate *js)
 {
 	unsigned int l;
 
 	/* Length includes itself. */
 
-	if ((l = jpg2byte()) < 2)
-		exifdie("invalid JPEG marker (length mismatch)");
+	if ((l = jpg2byte(js)) < 2)
+		jpgfail("invalid JPEG marker (length mismatch)", js);
 	return (l - 2);
 }
 
 
 /*
- * Skip over an uninteresting marker.
+ * Step over l bytes of the JPEG.  Past the window, we seek if we can, or
+ * else read through them a window at a time (for a pipe, say).
  */
 static void
-skipmkr(void)
+jpgskip(size_t l, struct jpegstate *js)
 {
-	unsigned int l;
+	size_t have, n;
+
+	have = js->buflen - js->pos;
+	if (have >= l) {
+		js->pos += l;
+		return;
+	}
+	if (!js->fp) {
+		js->need = js->pos + l;
+		js->pos = js->buflen;
+		jpgfail("invalid JPEG format", js);
+	}
+	l -= have;
+	js->buf = js->win;
+	js->buflen = js->pos = 0;
+
+	if (l <= LONG_MAX && !fseek(js->fp, (long)l, SEEK_CUR))
+		return;
 
-	l = mkrlen();
 	while (l) {
-		jpg1byte();
-		l--;
+		n = fread(js->win, 1, l < JPEG_WINLEN ? l : JPEG_WINLEN,
+		    js->fp);
+		if (!n)
+			jpgfail("invalid JPEG format", js);
+		l -= n;
 	}
 }
 
 
+/*
+ * Skip over an uninteresting marker.
+ */
+static void
+skipmkr(struct jpegstate *js)
+{
+
+	jpgskip(mkrlen(js), js);
+}
+
+
 /*
  * Check the first bytes of the file for a marker.
  */
 static int
-topmkr(void)
+topmkr(struct jpegstate *js)
 {
 
-	if (jpg1byte() != JPEG_M_BEG)
+	if (jpg1byte(js) != JPEG_M_BEG)
 		return (JPEG_M_ERR);
-	return (jpg1byte());
+	return (jpg1byte(js));
 }
 
 
@@ -165,22 +261,37 @@ topmkr(void)
  * Find the next JPEG marker in the file.
  */
 static int
-nxtmkr(void)
+nxtmkr(struct jpegstate *js)
 {
 	int b;
 	int bad = 0;
+	const unsigned char *p;
 
-	/* Read until we see JPEG_MARKER. */
+	/* Read until we see JPEG_MARKER, a window at a time. */
 
-	while ((b = jpg1byte()) != JPEG_M_BEG)
+	for (;;) {
+		p = memchr(js->buf + js->pos, JPEG_M_BEG,
+		    js->buflen - js->pos);
+		if (p) {
+			if (p != js->buf + js->pos)
+				bad++;
+			js->pos = p - js->buf + 1;
+			break;
+		}
+		if (js->pos != js->buflen)
+			bad++;
+		js->pos = js->buflen;
+		if (jpg1byte(js) == JPEG_M_BEG)
+			break;
 		bad++;
+	}
 
 	/* Read all JPEG_M_BEGs (which may be used for padding). */
 
-	while ((b = jpg1byte()) == JPEG_M_BEG);
+	while ((b = jpg1byte(js)) == JPEG_M_BEG);
 
 	if (bad)
-		exifwarn("skipped spurious bytes in JPEG");
+		jpgnote(EXIF_OK, "skipped spurious bytes in JPEG", js);
 
 	return (b);
 }
@@ -191,66 +302,97 @@ nxtmkr(void)
  * XXX Note that we clobber any previously collected info...
  */
 static void
-sofmrk(int mark)
+sofmrk(int mark, struct jpegstate *js)
 {
 	int i;
 	unsigned int l;
 
-	l = mkrlen();
-	jpg_prcsn = jpg1byte();
-	jpg_height = jpg2byte();
-	jpg_width = jpg2byte();
-	jpg_cmpnts = jpg1byte();
+	l = mkrlen(js);
+	js->prcsn = jpg1byte(js);
+	js->height = jpg2byte(js);
+	js->width = jpg2byte(js);
+	js->cmpnts = jpg1byte(js);
 
 	for (i = 0; process[i].sof < JPEG_M_ERR; i++)
 		if (process[i].sof == mark)
 			break;
-	jpg_prcss = process[i].str;
+	js->prcss = process[i].str;
 
 	/* Verify length. */
 
-	if (l != (unsigned int)(6 + jpg_cmpnts * 3))
-		exifdie("invalid JPEG SOF marker (length mismatch)");
+	if (l != (unsigned int)(6 + js->cmpnts * 3))
+		jpgfail("invalid JPEG SOF marker (length mismatch)", js);
 
 	/* Skip over component info we don't care about. */
 
-	for (i = 0; i < jpg_cmpnts; i++) {
-		jpg1byte(); jpg1byte(); jpg1byte();
+	for (i = 0; i < js->cmpnts; i++) {
+		jpg1byte(js); jpg1byte(js); jpg1byte(js);
 	}
 
-	seensof = TRUE;
+	js->seensof = TRUE;
 }
 
 
 /*
- * Scan through a JPEG file for markers, returning interesting ones.
- * Returns false when it's done with the file.
+ * Scan for markers, returning interesting ones, from js's window onto
+ * the JPEG (topped up from js->fp, if it's set).  See jpegscanmem().
  */
-int
-jpegscan(FILE *fp, int *mark, unsigned int *len, int first)
+static int
+scan(int *mark, unsigned int *len, int first, struct jpegstate *js)
 {
-	infile = fp;
+	jmp_buf fail;
+	size_t l;
 
 	/* First time through. */
 
-	if (first && topmkr() != JPEG_M_SOI) {
-		exifwarn("doesn't appear to be a JPEG file; "
-		    "searching for start of image");
-		if (nxtmkr() != JPEG_M_SOI)
-			exifdie("start of image not found");
+	if (first) {
+		js->prcsn = js->cmpnts = 0;
+		js->height = js->width = 0;
+		js->prcss = NULL;
+		js->seensof = FALSE;
+		js->seensoi = FALSE;
+		js->error = EXIF_OK;
+	}
+	js->diags = NULL;
+	js->ndiag = 0;
+
+	/* Once the file's gone bad, it stays that way. */
+
+	if (js->error)
+		return (FALSE);
+	if (setjmp(fail))
+		return (FALSE);
+	js->fail = (void *)&fail;
+
+	/* Step over whatever the caller left of the last marker's data. */
+
+	if (js->skip) {
+		l = js->skip;
+		js->skip = 0;
+		jpgskip(l, js);
+	}
+
+	if (!js->seensoi && topmkr(js) != JPEG_M_SOI) {
+		jpgnote(EXIF_OK, "doesn't appear to be a JPEG file; "
+		    "searching for start of image", js);
+		if (nxtmkr(js) != JPEG_M_SOI)
+			jpgfail("start of image not found", js);
 	}
+	js->seensoi = TRUE;
 
 	/* Look for interesting markers. */
 
 	for (;;) {
-		switch ((*mark = nxtmkr())) {
+		js->mkr = js->pos;
+		switch ((*mark = nxtmkr(js))) {
 		case JPEG_M_EOI:
 		case JPEG_M_SOS:
 			return (FALSE);
 
 		case JPEG_M_APP1:
 		case JPEG_M_APP2:
-			*len = mkrlen();
+			*len = mkrlen(js);
+			js->skip = *len;
 			return (TRUE);
 
 		/* We might as well collect some useful info from SOFs. */
@@ -267,13 +409,13 @@ jpegscan(FILE *fp, int *mark, unsigned int *len, int first)
 		case JPEG_M_SOF13:
 		case JPEG_M_SOF14:
 		case JPEG_M_SOF15:
-			sofmrk(*mark);
+			sofmrk(*mark, js);
 			break;
 
 		/* Just skip past markers we don't care about. */
 
 		default:
-			skipmkr();
+			skipmkr(js);
 		}
 	}
 
@@ -281,20 +423,222 @@ jpegscan(FILE *fp, int *mark, unsigned int *len, int first)
 }
 
 
+/*
+ * Scan through a JPEG held in memory (or mapped; see jpegmap()) in the
+ * len bytes at b for markers, returning interesting ones.  Returns false
+ * when it's done with the JPEG, or if it's bad (with js->error set).
+ * All of our progress is kept in js, which is set up when first is true,
+ * so any number of JPEGs can be scanned at once.  An interesting
+ * marker's data is left where it is, at offset off into b, for dlen
+ * bytes -- which can run past the end of b, if it's truncated.  The next
+ * call takes up after the data.
+ *
+ * b needn't be the whole JPEG, just its first len bytes.  If the scan
+ * runs off the end, it fails, and js->need says how many bytes would have
+ * done (which isn't to say more won't be wanted after that).  Call again
+ * with at least that many (b may have moved) and it picks up at the
+ * marker it was on.
+ */
+int
+jpegscanmem(const unsigned char *b, size_t len, int *mark, size_t *off,
+    unsigned int *dlen, int first, struct jpegstate *js)
+{
+
+	js->fp = NULL;
+	js->buf = b;
+	js->buflen = len;
+	if (first)
+		js->pos = js->mkr = js->skip = js->need = 0;
+	else if (js->need) {
+		js->error = EXIF_OK;
+		js->need = 0;
+		js->pos = js->mkr;
+	}
+
+	/* Step over the last marker's data. */
+
+	if (len - js->pos < js->skip) {
+		js->diags = NULL;
+		js->ndiag = 0;
+		js->mkr = js->pos;
+		js->need = js->pos + js->skip;
+		js->error = EXIF_EFORMAT;
+		jpgnote(EXIF_EFORMAT, "invalid JPEG format", js);
+		return (FALSE);
+	}
+	js->pos += js->skip;
+	js->skip = 0;
+
+	if (!scan(mark, dlen, first, js))
+		return (FALSE);
+	*off = js->pos;
+	return (TRUE);
+}
+
+
+/*
+ * Like jpegscanmem(), but for a JPEG file, which needn't be seekable.  We
+ * read it a window at a time, so when an interesting marker is returned,
+ * some of its len bytes of data may already be in hand: the caller gets
+ * them with jpegdata(), not from the file.  Whatever it doesn't get is
+ * skipped by the next call.
+ */
+int
+jpegscan(FILE *fp, int *mark, unsigned int *len, int first,
+    struct jpegstate *js)
+{
+
+	js->fp = fp;
+	js->need = 0;
+	if (first) {
+		js->buf = js->win;
+		js->buflen = js->pos = js->skip = 0;
+	}
+	return (scan(mark, len, first, js));
+}
+
+
+/*
+ * Get up to len bytes of the data of the marker last returned by
+ * jpegscan() (or jpegscanmem()) into b.  Returns how many we got, which
+ * is short at the end of the data or the file.
+ */
+size_t
+jpegdata(unsigned char *b, size_t len, struct jpegstate *js)
+{
+	size_t n;
+
+	if (len > js->skip)
+		len = js->skip;
+	n = js->buflen - js->pos;
+	if (n > len)
+		n = len;
+	memcpy(b, js->buf + js->pos, n);
+	js->pos += n;
+	if (n < len && js->fp)
+		n += fread(b + n, 1, len - n, js->fp);
+	js->skip -= n;
+	return (n);
+}
+
+
+/*
+ * Returns the offset into the file of where jpegscan() is, as ftell()
+ * would if we didn't read ahead.  Just after jpegscan() returns a marker,
+ * that's the start of its data.
+ */
+long
+jpegtell(struct jpegstate *js)
+{
+	long off;
+
+	if ((off = ftell(js->fp)) == -1)
+		return (-1);
+	return (off - (long)(js->buflen - js->pos));
+}
+
+
+/*
+ * Map a JPEG file into memory for jpegscanmem(), if we can, setting len
+ * to its size.  It's read from the start, so the file shouldn't have
+ * been read from yet.  We tell the system we'll be reading the first
+ * part of it (where the headers are) in order; whatever image data lies
+ * beyond needn't be read in at all.  Returns NULL if the file isn't
+ * something we can map -- a pipe, for instance -- in which case the
+ * caller can use jpegscan() instead.
+ */
+const unsigned char *
+jpegmap(FILE *fp, size_t *len)
+{
+#ifdef WIN32
+	return (NULL);
+#else
+	struct stat st;
+	void *p;
+	size_t hint;
+
+	if (ftell(fp) != 0 || fstat(fileno(fp), &st) ||
+	    !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+	    (off_t)(size_t)st.st_size != st.st_size)
+		return (NULL);
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+	    fileno(fp), 0);
+	if (p == MAP_FAILED)
+		return (NULL);
+
+	*len = (size_t)st.st_size;
+	hint = *len < JPEG_MAPHINT ? *len : JPEG_MAPHINT;
+#ifdef MADV_SEQUENTIAL
+	madvise(p, hint, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+	madvise(p, hint, MADV_WILLNEED);
+#endif
+	return ((const unsigned char *)p);
+#endif
+}
+
+
+/*
+ * Unmap a JPEG file mapped with jpegmap().
+ */
+void
+jpegunmap(const unsigned char *b, size_t len)
+{
+
+#ifndef WIN32
+	munmap((void *)b, len);
+#endif
+}
+
+
+/*
+ * Read len bytes of a JPEG file, starting off bytes in, into b, for
+ * jpegscanmem().  Where we can, it's one positioned read that leaves the
+ * file where it was; otherwise (a pipe, say), the file must already be
+ * at off.  Returns how many bytes were read, which is short only at the
+ * end of the file or on error.
+ */
+size_t
+jpegread(FILE *fp, unsigned char *b, size_t off, size_t len)
+{
+#ifndef WIN32
+	size_t got;
+	ssize_t r;
+
+	for (got = 0; got < len; got += (size_t)r) {
+		r = pread(fileno(fp), b + got, len - got, (off_t)(off + got));
+		if (r == -1 && errno == EINTR)
+			r = 0;
+		else if (r == -1 && errno == ESPIPE && !got)
+			return (fread(b, 1, len, fp));
+		else if (r <= 0)
+			break;
+	}
+	return (got);
+#else
+	if (fseek(fp, (long)off, SEEK_SET))
+		return (0);
+	return (fread(b, 1, len, fp));
+#endif
+}
+
+
 /*
  * Returns some basic image info about the JPEG, gleaned from start of
  * frame sections.
  */
 int
 jpeginfo(int *prcsn, int *cmpnts, unsigned int *height, unsigned int *width,
-    const char *prcss)
+    const char **prcss, struct jpegstate *js)
 {
 
-	*prcsn = jpg_prcsn;
-	*cmpnts = jpg_cmpnts;
-	*height = jpg_height;
-	*width = jpg_width;
-	prcss = jpg_prcss;
+	*prcsn = js->prcsn;
+	*cmpnts = js->cmpnts;
+	*height = js->height;
+	*width = js->width;
+	*prcss = js->prcss;
 
-	return (seensof);
+	return (js->seensof);
 }
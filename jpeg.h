@@ -43,6 +43,10 @@
 #ifndef _JPEG_H
 #define _JPEG_H
 
+#include <stdio.h>
+
+#include "exif.h"
+
 /* The JPEG marker codes we're interested in. */
 
 #define JPEG_M_BEG	0xff	/* Start of marker. */
@@ -67,10 +71,63 @@
 #define JPEG_M_ERR	0x100
 
 
+/*
+ * Scanner state for a JPEG, including some data we collect from a start
+ * of frame.  Each JPEG being scanned needs its own.  The scanner works on
+ * a window onto the JPEG: all of it, if it's in memory, or else up to
+ * JPEG_WINLEN bytes at a time read from the file.  As with Exif parsing,
+ * problems aren't printed: each jpegscanmem() or jpegscan() call leaves a
+ * list of what it ran into in diags (holding up to JPEG_DIAGMAX records),
+ * and if it quit because the JPEG's bad, error is set.
+ */
+
+#define JPEG_DIAGMAX	8
+#define JPEG_WINLEN	8192
+
+struct jpegstate {
+	FILE *fp;		/* File being scanned, if any. */
+	const unsigned char *buf; /* Window onto the JPEG. */
+	size_t buflen;		/* Length of buf. */
+	size_t pos;		/* Where we are in buf (internal only). */
+	size_t skip;		/* Data to step over next (internal only). */
+	size_t mkr;		/* Where the marker began (internal only). */
+	size_t need;		/* Bytes of buf wanted, if it ran short. */
+	unsigned char win[JPEG_WINLEN]; /* File's window (internal only). */
+	int prcsn;		/* Precision. */
+	int cmpnts;		/* Number of components. */
+	unsigned int height;	/* Image height. */
+	unsigned int width;	/* Image width. */
+	const char *prcss;	/* Process. */
+	int seensof;		/* Seen a start of frame? */
+	int seensoi;		/* Seen the start of image (internal only)? */
+	int error;		/* Error that ended the scan, or EXIF_OK. */
+	struct exifdiag *diags;	/* Diagnostics from the last call. */
+	struct exifdiag diag[JPEG_DIAGMAX]; /* Records (internal only). */
+	int ndiag;		/* Records used (internal only). */
+	void *fail;		/* Where failures go (internal only). */
+};
+
+
+/*
+ * How much of a mapped file (see jpegmap()) we expect to read: enough
+ * for the usual headers, and short of most image data.
+ */
+
+#define JPEG_MAPHINT	131072
+
+
 /* Our JPEG utility functions. */
 
-extern int jpegscan(FILE *fp, int *mark, unsigned int *len, int first);
+extern int jpegscanmem(const unsigned char *b, size_t len, int *mark,
+    size_t *off, unsigned int *dlen, int first, struct jpegstate *js);
+extern int jpegscan(FILE *fp, int *mark, unsigned int *len, int first,
+    struct jpegstate *js);
+extern size_t jpegdata(unsigned char *b, size_t len, struct jpegstate *js);
+extern long jpegtell(struct jpegstate *js);
+extern size_t jpegread(FILE *fp, unsigned char *b, size_t off, size_t len);
+extern const unsigned char *jpegmap(FILE *fp, size_t *len);
+extern void jpegunmap(const unsigned char *b, size_t len);
 extern int jpeginfo(int *prcsn, int *cmpnts, unsigned int *height,
-    unsigned int *width, const char *prcss);
+    unsigned int *width, const char **prcss, struct jpegstate *js);
 
 #endif
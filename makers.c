@@ -43,18 +43,19 @@
 
 
 struct makerfun makers[] = {
-	{ 0, "unknown", NULL, NULL },		/* default value */
-	{ EXIF_MKR_CANON, "canon", canon_prop, canon_ifd },
-	{ EXIF_MKR_OLYMPUS, "olympus", olympus_prop, olympus_ifd },
-	{ EXIF_MKR_FUJI, "fujifilm", fuji_prop, fuji_ifd },
-	{ EXIF_MKR_NIKON, "nikon", nikon_prop, nikon_ifd },
-	{ EXIF_MKR_CASIO, "casio", NULL, casio_ifd },
-	{ EXIF_MKR_MINOLTA, "minolta", minolta_prop, minolta_ifd },
-	{ EXIF_MKR_SANYO, "sanyo", sanyo_prop, sanyo_ifd },
-	{ EXIF_MKR_ASAHI, "asahi", asahi_prop, asahi_ifd },
-	{ EXIF_MKR_PENTAX, "pentax", asahi_prop, asahi_ifd },
-	{ EXIF_MKR_LEICA, "leica", leica_prop, leica_ifd },
-	{ EXIF_MKR_PANASONIC, "panasonic", panasonic_prop, panasonic_ifd },
-	{ EXIF_MKR_SIGMA, "sigma", sigma_prop, sigma_ifd },
-	{ EXIF_MKR_UNKNOWN, "unknown", NULL, NULL },
+	{ 0, "unknown", NULL, NULL, FALSE },		/* default value */
+	{ EXIF_MKR_CANON, "canon", canon_prop, canon_ifd, FALSE },
+	{ EXIF_MKR_OLYMPUS, "olympus", olympus_prop, olympus_ifd, FALSE },
+	{ EXIF_MKR_FUJI, "fujifilm", fuji_prop, fuji_ifd, FALSE },
+	{ EXIF_MKR_NIKON, "nikon", nikon_prop, nikon_ifd, TRUE },
+	{ EXIF_MKR_CASIO, "casio", NULL, casio_ifd, FALSE },
+	{ EXIF_MKR_MINOLTA, "minolta", minolta_prop, minolta_ifd, FALSE },
+	{ EXIF_MKR_SANYO, "sanyo", sanyo_prop, sanyo_ifd, FALSE },
+	{ EXIF_MKR_ASAHI, "asahi", asahi_prop, asahi_ifd, FALSE },
+	{ EXIF_MKR_PENTAX, "pentax", asahi_prop, asahi_ifd, FALSE },
+	{ EXIF_MKR_LEICA, "leica", leica_prop, leica_ifd, FALSE },
+	{ EXIF_MKR_PANASONIC, "panasonic", panasonic_prop, panasonic_ifd,
+	    FALSE },
+	{ EXIF_MKR_SIGMA, "sigma", sigma_prop, sigma_ifd, FALSE },
+	{ EXIF_MKR_UNKNOWN, "unknown", NULL, NULL, FALSE },
 };
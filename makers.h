@@ -49,11 +49,14 @@
 
 /* Maker note function table. */
 
+#define MKRHDRLEN	18	/* Note header bytes read before the IFD. */
+
 struct makerfun {
 	int val;
 	const char *name;
 	void (*propfun)();		/* Function to parse properties. */
 	struct ifd *(*ifdfun)();	/* Function to read IFD. */
+	int chkdef;			/* Check tags against definitions? */
 };
 extern struct makerfun makers[];
 
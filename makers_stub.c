@@ -42,6 +42,6 @@
 
 
 struct makerfun makers[] = {
-	{ 0, "unknown", NULL, NULL },		/* default value */
-	{ EXIF_MKR_UNKNOWN, "unknown", NULL, NULL },
+	{ 0, "unknown", NULL, NULL, FALSE },		/* default value */
+	{ EXIF_MKR_UNKNOWN, "unknown", NULL, NULL, FALSE },
 };
@@ -50,6 +50,11 @@
 #include "makers.h"
 
 
+/* Per-parse state (in t->mkrflags). */
+
+#define MINOLTA_F_HDR	0x01	/* Debug header printed. */
+
+
 /* Bracketing mode. */
 
 static struct descrip minolta_brackmode[] = {
@@ -410,12 +415,13 @@ void
 minolta_cprop(struct exifprop *prop, unsigned char *off, struct exiftags *t,
     struct exiftag *thetags)
 {
-	unsigned int i, j, k;
+	unsigned int i, k;
 	u_int32_t v;
 	int32_t model;
 	double d;
 	char *valbuf;
 	unsigned char buf[8];
+	struct exiftag *def;
 	struct exifprop *aprop;
 
 	valbuf = NULL;
@@ -435,7 +441,7 @@ minolta_cprop(struct exifprop *prop, unsigned char *off, struct exiftags *t,
 		} else
 			k = i;
 
-		aprop = childprop(prop);
+		aprop = childprop(prop, t);
 		aprop->tag = i;
 		aprop->tagset = thetags;
 
@@ -444,16 +450,15 @@ minolta_cprop(struct exifprop *prop, unsigned char *off, struct exiftags *t,
 
 		/* Lookup property name and description. */
 
-		for (j = 0; thetags[j].tag < EXIF_T_UNKNOWN &&
-			thetags[j].tag != k; j++);
-		aprop->name = thetags[j].name;
-		aprop->descr = thetags[j].descr;
-		aprop->lvl = thetags[j].lvl;
-		if (thetags[j].table)
-			aprop->str = finddescr(thetags[j].table,
-			    (u_int16_t)aprop->value);
+		def = aprop->def = findtag(thetags, (u_int16_t)k, t);
+		aprop->name = def->name;
+		aprop->descr = def->descr;
+		aprop->lvl = def->lvl;
+		if (def->table)
+			descrprop(aprop, def->table,
+			    (u_int16_t)aprop->value, t);
 
-		dumpprop(aprop, NULL);
+		dumpprop(aprop, NULL, t);
 
 		/*
 		 * Further process known properties.
@@ -466,7 +471,7 @@ minolta_cprop(struct exifprop *prop, unsigned char *off, struct exiftags *t,
 			continue;
 
 		if (!valbuf)
-			exifstralloc(&valbuf, 16);
+			exifstralloc(&valbuf, 16, t);
 
 		switch (k) {
 
@@ -643,8 +648,6 @@ minolta_cprop(struct exifprop *prop, unsigned char *off, struct exiftags *t,
 			break;
 		}
 	}
-	if (valbuf)
-		free(valbuf);
 }
 
 
@@ -652,17 +655,16 @@ minolta_cprop(struct exifprop *prop, unsigned char *off, struct exiftags *t,
  * Make sure meaningless values are meaningless.
  */
 static void
-minolta_naval(struct exifprop *props, struct exiftag *tags, int16_t tag)
+minolta_naval(struct exiftag *tags, int16_t tag, struct exiftags *t)
 {
 	struct exifprop *prop;
 	const char *na = "n/a";
 
-	if (!(prop = findprop(props, tags, tag)))
+	if (!(prop = findprop(t, tags, tag)))
 		return;
 
-	free(prop->str);
 	prop->str = NULL;
-	exifstralloc(&prop->str, strlen(na) + 1);
+	exifstralloc(&prop->str, strlen(na) + 1, t);
 	strcpy(prop->str, na);
 	if (!(prop->lvl & ED_UNK))
 		prop->lvl = ED_VRB;
@@ -678,14 +680,12 @@ minolta_prop(struct exifprop *prop, struct exiftags *t)
 	struct exiftag *fielddefs = NULL;
 	struct exifprop *tmpprop;
 
-	if (debug) {
-		static int once = 0;	/* XXX Breaks on multiple files. */
-
-		if (!once) {
+	if (t->debug) {
+		if (!(t->mkrflags & MINOLTA_F_HDR)) {
 			printf("Processing Minolta Maker Note\n");
-			once = 1;
+			t->mkrflags |= MINOLTA_F_HDR;
 		}
-		dumpprop(prop, NULL);
+		dumpprop(prop, NULL, t);
 	}
 
 	switch (prop->tag) {
@@ -695,15 +695,15 @@ minolta_prop(struct exifprop *prop, struct exiftags *t)
 	case 0x0000:
 		if (prop->count < 4)
 			break;
-		exifstralloc(&prop->str, prop->count + 1);
+		exifstralloc(&prop->str, prop->count + 1, t);
 		byte4exif(prop->value, (unsigned char *)prop->str,
 		    t->mkrmd.order);
 
 		/* We recognize two types: MLT0 and mlt0. */
 
 		if (strcmp(prop->str, "MLT0") && strcmp(prop->str, "mlt0"))
-			exifwarn2("Minolta maker note version not supported",
-			    prop->str);
+			exifnote("Minolta maker note version not supported",
+			    prop->str, t);
 		break;
 
 	/*
@@ -713,7 +713,8 @@ minolta_prop(struct exifprop *prop, struct exiftags *t)
 
 	case 0x0001:
 		if (prop->count != 39 * 4) {
-			exifwarn("Minolta maker note not fully supported");
+			exifnote("Minolta maker note not fully supported",
+			    NULL, t);
 			fielddefs = minolta_unkn;
 		} else
 			fielddefs = minolta_MLT0;
@@ -722,7 +723,8 @@ minolta_prop(struct exifprop *prop, struct exiftags *t)
 
 	case 0x0003:
 		if (prop->count != 56 * 4 && prop->count != 57 * 4) {
-			exifwarn("Minolta maker note not fully supported");
+			exifnote("Minolta maker note not fully supported",
+			    NULL, t);
 			fielddefs = minolta_unkn;
 		} else
 			fielddefs = minolta_MLT0;
@@ -736,51 +738,51 @@ minolta_prop(struct exifprop *prop, struct exiftags *t)
 
 		/* Drive mode (bracketing step & mode). */
 
-		if ((tmpprop = findprop(t->props, fielddefs, 6)))
+		if ((tmpprop = findprop(t, fielddefs, 6)))
 			if (tmpprop->value != 4) {
-				minolta_naval(t->props, fielddefs, 14);
-				minolta_naval(t->props, fielddefs, 50);
+				minolta_naval(fielddefs, 14, t);
+				minolta_naval(fielddefs, 50, t);
 			}
 
 		/* Focus mode (wide focus area, AF zone, point X & Y). */
 
-		if ((tmpprop = findprop(t->props, fielddefs, 48)))
+		if ((tmpprop = findprop(t, fielddefs, 48)))
 			if (tmpprop->value == 1) {
-				minolta_naval(t->props, fielddefs, 45);
-				minolta_naval(t->props, fielddefs, 46);
-				minolta_naval(t->props, fielddefs, 47);
-				minolta_naval(t->props, fielddefs, 49);
+				minolta_naval(fielddefs, 45, t);
+				minolta_naval(fielddefs, 46, t);
+				minolta_naval(fielddefs, 47, t);
+				minolta_naval(fielddefs, 49, t);
 			}
 
 		/* Flash fired (flash comp, mode, & internal flash). */
 
-		if ((tmpprop = findprop(t->props, fielddefs, 20)))
+		if ((tmpprop = findprop(t, fielddefs, 20)))
 			if (tmpprop->value != 1) {
-				minolta_naval(t->props, fielddefs, 2);
-				minolta_naval(t->props, fielddefs, 35);
-				minolta_naval(t->props, fielddefs, 43);
+				minolta_naval(fielddefs, 2, t);
+				minolta_naval(fielddefs, 35, t);
+				minolta_naval(fielddefs, 43, t);
 			}
 
 		/* Exposure mode (meter mode, exposure comp). */
 
-		if ((tmpprop = findprop(t->props, tags, EXIF_T_EXPMODE)))
+		if ((tmpprop = findprop(t, tags, EXIF_T_EXPMODE)))
 			if (tmpprop->value == 1) {
-				minolta_naval(t->props, fielddefs, 7);
-				minolta_naval(t->props, fielddefs, 13);
+				minolta_naval(fielddefs, 7, t);
+				minolta_naval(fielddefs, 13, t);
 			}
 
 		/* Exposure prog (scene capture type). */
 
-		if ((tmpprop = findprop(t->props, fielddefs, 1)))
+		if ((tmpprop = findprop(t, fielddefs, 1)))
 			if (tmpprop->value != 0)
-				minolta_naval(t->props, fielddefs, 34);
+				minolta_naval(fielddefs, 34, t);
 
 		/* Interval mode (interval pics, time). */
 
-		if ((tmpprop = findprop(t->props, fielddefs, 38)))
+		if ((tmpprop = findprop(t, fielddefs, 38)))
 			if (tmpprop->value != 1) {
-				minolta_naval(t->props, fielddefs, 16);
-				minolta_naval(t->props, fielddefs, 17);
+				minolta_naval(fielddefs, 16, t);
+				minolta_naval(fielddefs, 17, t);
 			}
 	}
 }
@@ -796,7 +798,8 @@ minolta_ifd(u_int32_t offset, struct tiffmeta *md)
 	/* DiMAGE E201. */
 
 	if (!strcmp((const char *)(md->btiff + offset), "+M")) {
-		exifwarn("Minolta maker note version not supported");
+		exifnote("Minolta maker note version not supported", NULL,
+		    md->t);
 		return (NULL);
 	}
 
@@ -807,7 +810,8 @@ minolta_ifd(u_int32_t offset, struct tiffmeta *md)
 
 	if (exif2byte(md->btiff + offset, md->order) > 0xff ||
 	    exif2byte(md->btiff + offset, md->order) < 0x02) {
-		exifwarn("Minolta maker note version not supported");
+		exifnote("Minolta maker note version not supported", NULL,
+		    md->t);
 		return (NULL);
 	}
 
@@ -312,7 +312,7 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 {
 	int i;
 	u_int32_t v[8];
-	char *c1, *c2, *c3;
+	const char *c1, *c2, *c3;
 	int32_t sn, sd;
 	char buf[5];
 
@@ -331,7 +331,7 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 		buf[2] = '\0';
 		v[0] = atoi(buf);
 
-		exifstralloc(&prop->str, 8);
+		exifstralloc(&prop->str, 8, t);
 		snprintf(prop->str, 7, "%d.%d", v[0], v[1]);
 		break;
 
@@ -352,7 +352,7 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 		else
 			v[0] = prop->value & 0xffff;
 
-		exifstralloc(&prop->str, 32);
+		exifstralloc(&prop->str, 32, t);
 		snprintf(prop->str, 31, "%d", (u_int16_t)v[0]);
 		if (!v[0]) prop->lvl = ED_VRB;
 		break;
@@ -367,7 +367,7 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 
 	case 0x0012:
 	case 0x0018:
-		exifstralloc(&prop->str, 10);
+		exifstralloc(&prop->str, 10, t);
 		snprintf(prop->str, 9, "%.1f EV",
 		    (int16_t)(prop->value >> 24) / 6.0);
 		break;
@@ -390,8 +390,8 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 	/* Lens type. */
 
 	case 0x0083:
-		prop->str = finddescr(nikon_lenstype,
-		    (u_int16_t)((prop->value >> 24) & 0xff));
+		descrprop(prop, nikon_lenstype,
+		    (u_int16_t)((prop->value >> 24) & 0xff), t);
 		break;
 
 	/* Lens range. */
@@ -482,33 +482,32 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 		 */
 		if (!(prop->value & 0xffff00ff)) {
 			if (prop->str) printf("err, hello?  overwriting?\n");
-			prop->str = finddescr(nikon_afpos,
-			    (u_int16_t)((prop->value >> 8) & 0xff));
+			descrprop(prop, nikon_afpos,
+			    (u_int16_t)((prop->value >> 8) & 0xff), t);
 			break;
 		}
 
 		/* Byte 1, mode. */
 		c1 = finddescr(nikon_afmode,
-		    (u_int16_t)((prop->value >> 24) & 0xff));
+		    (u_int16_t)((prop->value >> 24) & 0xff), t);
 
 		/* Byte 2, area selected; byte 4, area focused. */
-		c2 = finddescr(nikon_afpos, (u_int16_t)(prop->value & 0xff));
+		c2 = finddescr(nikon_afpos, (u_int16_t)(prop->value & 0xff),
+		    t);
 
 		if ((prop->value & 0xff) == ((prop->value >> 16) & 0xff)) {
-			exifstralloc(&prop->str, strlen(c1) + strlen(c2) + 3);
+			exifstralloc(&prop->str,
+			    strlen(c1) + strlen(c2) + 3, t);
 			sprintf(prop->str, "%s, %s", c1, c2);
 
 		} else {
 			c3 = finddescr(nikon_afpos,
-			    (u_int16_t)((prop->value >> 16) & 0xff));
+			    (u_int16_t)((prop->value >> 16) & 0xff), t);
 			exifstralloc(&prop->str, strlen(c1) + strlen(c2) +
-			    strlen(c3) + 24);
+			    strlen(c3) + 24, t);
 			sprintf(prop->str, "%s, %s Selected, %s Focused",
 			    c1, c3, c2);
-			free(c3);
 		}
-		free(c1);
-		free(c2);
 		break;
 
 	/*
@@ -525,7 +524,8 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 			prop->value = (prop->value >> 8) & 0xff;
 
 		/* Bits 0 & 1. */
-		c1 = finddescr(nikon_shoot, (u_int16_t)(prop->value & 0x03));
+		c1 = finddescr(nikon_shoot, (u_int16_t)(prop->value & 0x03),
+		    t);
 
 		/* Bit 4 = bracketing, bit 6 = white balance bracketing. */
 		if (prop->value & 0x40) {
@@ -540,9 +540,8 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 				c2 = "Off";
 		}
 
-		exifstralloc(&prop->str, strlen(c1) + strlen(c2) + 2);
+		exifstralloc(&prop->str, strlen(c1) + strlen(c2) + 2, t);
 		sprintf(prop->str, "%s/%s", c1, c2);
-		free(c1);
 		break;
 
 	/* Color mode. */
@@ -551,28 +550,25 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 		if (!(c1 = prop->str)) break;
 
 		if (!strncmp(c1, "MODE1a", 6)) {
-			free(c1);
 			prop->str = NULL;
 			c1 = "Portrait sRGB";
-			exifstralloc(&prop->str, strlen(c1) + 1);
+			exifstralloc(&prop->str, strlen(c1) + 1, t);
 			strcpy(prop->str, c1);
 			break;
 		}
 
 		if (!strncmp(c1, "MODE2", 5)) {
-			free(c1);
 			prop->str = NULL;
 			c1 = "Adobe RGB";
-			exifstralloc(&prop->str, strlen(c1) + 1);
+			exifstralloc(&prop->str, strlen(c1) + 1, t);
 			strcpy(prop->str, c1);
 			break;
 		}
 
 		if (!strncmp(c1, "MODE3a", 6)) {
-			free(c1);
 			prop->str = NULL;
 			c1 = "Landscape sRGB";
-			exifstralloc(&prop->str, strlen(c1) + 1);
+			exifstralloc(&prop->str, strlen(c1) + 1, t);
 			strcpy(prop->str, c1);
 			break;
 		}
@@ -585,13 +581,13 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 		switch (prop->value) {
 		case -3:
 			c1 = "Black & White";
-			exifstralloc(&prop->str, strlen(c1) + 1);
+			exifstralloc(&prop->str, strlen(c1) + 1, t);
 			strcpy(prop->str, c1);
 			break;
 
 		case 0:
 			c1 = "Normal";
-			exifstralloc(&prop->str, strlen(c1) + 1);
+			exifstralloc(&prop->str, strlen(c1) + 1, t);
 			strcpy(prop->str, c1);
 			break;
 		}
@@ -629,22 +625,8 @@ nikon_prop1(struct exifprop *prop, struct exiftags *t)
 void
 nikon_prop(struct exifprop *prop, struct exiftags *t)
 {
-	int i;
-
-	for (i = 0; prop->tagset[i].tag < EXIF_T_UNKNOWN &&
-	    prop->tagset[i].tag != prop->tag; i++);
-
-	if (prop->tagset[i].type && prop->tagset[i].type != prop->type)
-		exifwarn2("field type mismatch", prop->name);
-
-	/*
-	 * Check the field count.
-	 * XXX For whatever the reason, Sigma doesn't follow the
-	 * spec on count for FileSource.
-	 */
 
-	if (prop->tagset[i].count && prop->tagset[i].count != prop->count)
-		exifwarn2("field count mismatch", prop->name);
+	/* Field type and count were checked by readtag() (see makers[]). */
 
 	if (prop->tagset == nikon_tags0) {
 		nikon_prop0(prop, t);
@@ -697,7 +679,8 @@ nikon_ifd(u_int32_t offset, struct tiffmeta *md)
 			else if (!memcmp(b, "II", 2))
 				md->order = LITTLE;
 			else {
-				exifwarn("invalid Nikon TIFF header");
+				exifnote("invalid Nikon TIFF header", NULL,
+				    md->t);
 				return (NULL);
 			}
 			md->btiff = b;		/* Beginning of maker. */
@@ -706,7 +689,8 @@ nikon_ifd(u_int32_t offset, struct tiffmeta *md)
 			/* Verify the TIFF header. */
 
 			if (exif2byte(b, md->order) != 42) {
-				exifwarn("invalid Nikon TIFF header");
+				exifnote("invalid Nikon TIFF header", NULL,
+				    md->t);
 				return (NULL);
 			}
 			b += 2;
@@ -716,7 +700,8 @@ nikon_ifd(u_int32_t offset, struct tiffmeta *md)
 			return (myifd);
 
 		default:
-			exifwarn("Nikon maker note version not supported");
+			exifnote("Nikon maker note version not supported",
+			    NULL, md->t);
 			return (NULL);
 		}
 	}
@@ -113,7 +113,7 @@ olympus_prop(struct exifprop *prop, struct exiftags *t)
 
 		/* Picture taking mode. */
 
-		aprop = childprop(prop);
+		aprop = childprop(prop, t);
 		aprop->value = exif4byte(offset, t->mkrmd.order);
 		aprop->name = "OlympusPicMode";
 		aprop->descr = "Picture Mode";
@@ -121,7 +121,7 @@ olympus_prop(struct exifprop *prop, struct exiftags *t)
 
 		/* Sequence number. */
 
-		aprop = childprop(prop);
+		aprop = childprop(prop, t);
 		aprop->value = exif4byte(offset + 4, t->mkrmd.order);
 		aprop->name = "OlympusSeqNum";
 		aprop->descr = "Sequence Number";
@@ -129,7 +129,7 @@ olympus_prop(struct exifprop *prop, struct exiftags *t)
 
 		/* Panorama direction. */
 
-		aprop = childprop(prop);
+		aprop = childprop(prop, t);
 		aprop->value = exif4byte(offset + 8, t->mkrmd.order);
 		aprop->name = "OlympusPanDir";
 		aprop->descr = "Panoramic Direction";
@@ -152,7 +152,7 @@ olympus_prop(struct exifprop *prop, struct exiftags *t)
 	/* Image number. */
 
 	case 0x0008:
-		exifstralloc(&prop->str, 32);
+		exifstralloc(&prop->str, 32, t);
 		snprintf(prop->str, 31, "%03d-%04d", prop->value / 10000,
 		    prop->value % 10000);
 		break;
@@ -213,14 +213,14 @@ panasonic_prop(struct exifprop *prop, struct exiftags *t)
 	/* White balance adjust (unknown). */
 
 	case 0x0023:
-		exifstralloc(&prop->str, 10);
+		exifstralloc(&prop->str, 10, t);
 		snprintf(prop->str, 9, "%d", (int16_t)prop->value);
 		break;
 
 	/* Flash bias. */
 
 	case 0x0024:
-		exifstralloc(&prop->str, 10);
+		exifstralloc(&prop->str, 10, t);
 		snprintf(prop->str, 9, "%.2f EV", (int16_t)prop->value / 3.0);
 		break;
 
@@ -241,7 +241,7 @@ panasonic_ifd(u_int32_t offset, struct tiffmeta *md)
 {
 
 	if (memcmp("Panasonic\0\0\0", md->btiff + offset, 12)) {
-		exifwarn("Maker note format not supported");
+		exifnote("Maker note format not supported", NULL, md->t);
 		return (NULL);
 	}
 
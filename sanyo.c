@@ -262,17 +262,18 @@ static struct exiftag sanyo_shoottags[] = {
 void
 sanyo_prop(struct exifprop *prop, struct exiftags *t)
 {
-	int i, j;
+	int i;
 	u_int32_t a, b;
-	char *c1, *c2;
+	const char *c1, *c2;
 	struct exifprop *aprop;
+	struct exiftag *def;
 
 	switch (prop->tag) {
 
 	/* Various image data. */
 
 	case 0x0200:
-		if (debug)
+		if (t->debug)
 			printf("Processing %s (0x%04X) directory, %d entries\n",
 			    prop->name, prop->tag, prop->count);
 
@@ -280,7 +281,7 @@ sanyo_prop(struct exifprop *prop, struct exiftags *t)
 			a = exif4byte(t->mkrmd.btiff + prop->value + i * 2,
 			    t->mkrmd.order);
 
-			aprop = childprop(prop);
+			aprop = childprop(prop, t);
 			aprop->value = a;
 			aprop->tag = i;
 			aprop->tagset = sanyo_shoottags;
@@ -289,15 +290,14 @@ sanyo_prop(struct exifprop *prop, struct exiftags *t)
 
 			/* Lookup property name and description. */
 
-			for (j = 0; sanyo_shoottags[j].tag < EXIF_T_UNKNOWN &&
-			    sanyo_shoottags[j].tag != i; j++);
-			aprop->name = sanyo_shoottags[j].name;
-			aprop->descr = sanyo_shoottags[j].descr;
-			aprop->lvl = sanyo_shoottags[j].lvl;
-			if (sanyo_shoottags[j].table)
-				aprop->str =
-				    finddescr(sanyo_shoottags[j].table,
-				    (u_int16_t)a);
+			def = aprop->def = findtag(sanyo_shoottags,
+			    (u_int16_t)i, t);
+			aprop->name = def->name;
+			aprop->descr = def->descr;
+			aprop->lvl = def->lvl;
+			if (def->table)
+				descrprop(aprop, def->table, (u_int16_t)a,
+				    t);
 
 			switch (aprop->tag) {
 			case 0x0001:
@@ -307,7 +307,7 @@ sanyo_prop(struct exifprop *prop, struct exiftags *t)
 				break;
 			}
 
-			dumpprop(aprop, NULL);
+			dumpprop(aprop, NULL, t);
 		}
 		break;
 
@@ -315,12 +315,10 @@ sanyo_prop(struct exifprop *prop, struct exiftags *t)
 
 	case 0x0201:
 		c1 = finddescr(sanyo_quality,
-		    (u_int16_t)((prop->value >> 8) & 0xff));
-		c2 = finddescr(sanyo_res, (u_int16_t)(prop->value & 0xff));
-		exifstralloc(&prop->str, strlen(c1) + strlen(c2) + 3);
+		    (u_int16_t)((prop->value >> 8) & 0xff), t);
+		c2 = finddescr(sanyo_res, (u_int16_t)(prop->value & 0xff), t);
+		exifstralloc(&prop->str, strlen(c1) + strlen(c2) + 3, t);
 		sprintf(prop->str, "%s, %s", c1, c2);
-		free(c1);
-		free(c2);
 		break;
 
 	/* Digital zoom. */
@@ -338,7 +336,7 @@ sanyo_prop(struct exifprop *prop, struct exiftags *t)
 	/* Color adjust. */
 
 	case 0x0210:
-		prop->str = finddescr(sanyo_offon, (u_int16_t)(!!prop->value));
+		descrprop(prop, sanyo_offon, (u_int16_t)(!!prop->value), t);
 		break;
 	}
 }
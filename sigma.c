@@ -176,6 +176,6 @@ sigma_ifd(u_int32_t offset, struct tiffmeta *md)
 	    memcmp("FOVEON\0\0", md->btiff + offset, 8))
 		return (readifds(offset + 10, sigma_tags, md));
 
-	exifwarn("Sigma maker note version not supported");
+	exifnote("Sigma maker note version not supported", NULL, md->t);
 	return (NULL);
 }